@@ -29,6 +29,11 @@ bool ActiveStreamClient::sendRawData(const std::string& data)
    return serverConnection_->sendRawData(connectionId_, data);
 }
 
+bool ActiveStreamClient::sendRawData(std::string&& data)
+{
+   return serverConnection_->sendRawData(connectionId_, std::move(data));
+}
+
 void ActiveStreamClient::notifyOnData(const std::string& data)
 {
    serverConnection_->notifyListenerOnData(connectionId_, data);
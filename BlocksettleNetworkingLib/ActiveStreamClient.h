@@ -36,11 +36,15 @@ public:
 
 public:
    virtual bool send(const std::string& data) = 0;
+   // Puts data in wire format, so it could be queued together with other clients' data.
+   // Returns false if not supported - send() is used then.
+   virtual bool frameData(const std::string& /*data*/, std::string& /*rawData*/) const { return false; }
 
    virtual void onRawDataReceived(const std::string& rawData) = 0;
 
 protected:
    bool sendRawData(const std::string& data);
+   bool sendRawData(std::string&& data);
    void notifyOnData(const std::string& data);
 
 protected:
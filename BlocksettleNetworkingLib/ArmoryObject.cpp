@@ -42,7 +42,10 @@ ArmoryObject::ArmoryObject(const std::shared_ptr<spdlog::logger> &logger
    : ArmoryConnection(logger)
    , cbInMainThread_(cbInMainThread)
    , txCache_(txCacheFN)
-{}
+{
+   act_ = std::make_unique<TxCacheACT>(this);
+   act_->init(this);
+}
 
 bool ArmoryObject::startLocalArmoryProcess(const ArmorySettings &settings)
 {
@@ -141,7 +144,11 @@ bool ArmoryObject::getWalletsLedgerDelegate(const LedgerDelegateCb &cb)
 bool ArmoryObject::getTxByHash(const BinaryData &hash, const TxCb &cb, bool allowCachedResult)
 {
    if (allowCachedResult) {
-      const auto tx = getFromCache(hash);
+      auto tx = getFromCache(hash);
+      // Recently reported unknown by the server - the same empty result is returned
+      if (!tx && txCache_.isUnknown(hash)) {
+         tx = std::make_shared<Tx>();
+      }
       if (tx) {
          if (needInvokeCb()) {
             QMetaObject::invokeMethod(this, [cb, tx] {
@@ -154,7 +161,10 @@ bool ArmoryObject::getTxByHash(const BinaryData &hash, const TxCb &cb, bool allo
       }
    }
    const auto &cbWrap = [this, cb, hash](Tx tx) {
-      putToCacheIfNeeded(hash, std::make_shared<Tx>(tx));
+      if (!tx.isInitialized()) {
+         txCache_.putUnknown(hash);
+      }
+      putToCacheIfNeeded({ { hash, std::make_shared<Tx>(tx) } });
       if (!cb) {
          return;
       }
@@ -184,12 +194,11 @@ bool ArmoryObject::getTXsByHash(const std::set<BinaryData> &hashes, const TXsCb
 
    std::set<BinaryData> missedHashes;
    if (allowCachedResult) {
-      for (const auto &hash : hashes) {
-         const auto tx = getFromCache(hash);
-         if (tx) {
-            (*result)[hash] = tx;
-         }
-         else {
+      std::vector<BinaryData> misses;
+      *result = txCache_.getBatch({ hashes.cbegin(), hashes.cend() }, misses);
+      for (const auto &hash : misses) {
+         // Recently reported unknown by the server - not requested again, so missing in result
+         if (!txCache_.isUnknown(hash)) {
             missedHashes.insert(hash);
          }
       }
@@ -201,15 +210,21 @@ bool ArmoryObject::getTXsByHash(const std::set<BinaryData> &hashes, const TXsCb
       cbInvokeWrap(*result, nullptr);
       return true;
    }
-   const auto &cbWrap = [this, cbInvokeWrap, result]
+   const auto &cbWrap = [this, cbInvokeWrap, result, missedHashes]
       (const AsyncClient::TxBatchResult &txs, std::exception_ptr exPtr)
    {
       if (exPtr != nullptr) {
          cbInvokeWrap({}, exPtr);
          return;
       }
+      for (const auto &hash : missedHashes) {
+         const auto itTx = txs.find(hash);
+         if ((itTx == txs.end()) || !itTx->second || !itTx->second->isInitialized()) {
+            txCache_.putUnknown(hash);
+         }
+      }
+      putToCacheIfNeeded(txs);
       for (const auto &tx : txs) {
-         putToCacheIfNeeded(tx.first, tx.second);
          (*result)[tx.first] = tx.second;
       }
       cbInvokeWrap(*result, nullptr);
@@ -289,28 +304,47 @@ std::shared_ptr<const Tx> ArmoryObject::getFromCache(const BinaryData &hash)
    return txCache_.get(hash);
 }
 
-void ArmoryObject::putToCacheIfNeeded(const BinaryData &hash, const std::shared_ptr<const Tx> &tx)
+void ArmoryObject::putToCacheIfNeeded(const AsyncClient::TxBatchResult &txs)
 {
-   if (!tx || !tx->isInitialized() || tx->getTxHeight() == UINT32_MAX) {
-      return;
-   }
    const auto topBlock = topBlock_.load();
    if (topBlock == 0 || topBlock == UINT32_MAX) {
       return;
    }
 
-   if (tx->getTxHeight() > topBlock) {
-      // should not happen
-      SPDLOG_LOGGER_ERROR(logger_, "invalid tx height: {}, topBlock: {}", tx->getTxHeight(), topBlock);
-      return;
+   AsyncClient::TxBatchResult toCache;
+   for (const auto &tx : txs) {
+      if (!tx.second || !tx.second->isInitialized() || tx.second->getTxHeight() == UINT32_MAX) {
+         continue;
+      }
+      if (tx.second->getTxHeight() > topBlock) {
+         // should not happen
+         SPDLOG_LOGGER_ERROR(logger_, "invalid tx height: {}, topBlock: {}", tx.second->getTxHeight(), topBlock);
+         continue;
+      }
+      if (topBlock - tx.second->getTxHeight() < kRequiredConfCountForCache) {
+         continue;
+      }
+      toCache.insert(tx);
    }
-   if (topBlock - tx->getTxHeight() < kRequiredConfCountForCache) {
+   if (toCache.empty()) {
       return;
    }
 
    try {
-      txCache_.put(hash, tx);
+      txCache_.putBatch(toCache);
    } catch (const std::exception &e) {
       SPDLOG_LOGGER_ERROR(logger_, "caching tx failed: {}", e.what());
    }
 }
+
+void ArmoryObject::onZCReceived(const std::vector<bs::TXEntry> &zcs)
+{
+   for (const auto &zc : zcs) {
+      txCache_.clearUnknown(zc.txHash);
+   }
+}
+
+void ArmoryObject::onNewBlock()
+{  // block could include TXs not relayed to mempool
+   txCache_.clearUnknown();
+}
@@ -47,12 +47,35 @@ private:
 
    std::shared_ptr<const Tx> getFromCache(const BinaryData &hash);
    // Will store only transactions with >= 6 confirmations
-   void putToCacheIfNeeded(const BinaryData &hash, const std::shared_ptr<const Tx> &tx);
+   void putToCacheIfNeeded(const AsyncClient::TxBatchResult &txs);
+
+   // Hashes reported unknown could appear in ZC or new block
+   void onZCReceived(const std::vector<bs::TXEntry> &);
+   void onNewBlock();
 
 private:
+   class TxCacheACT : public ArmoryCallbackTarget
+   {
+   public:
+      TxCacheACT(ArmoryObject *parent)
+         : parent_(parent)
+      {
+      }
+      ~TxCacheACT() override { cleanup(); }
+      void onZCReceived(const std::string &, const std::vector<bs::TXEntry> &zcs) override {
+         parent_->onZCReceived(zcs);
+      }
+      void onNewBlock(unsigned int, unsigned int) override {
+         parent_->onNewBlock();
+      }
+   private:
+      ArmoryObject *parent_;
+   };
+
    const bool     cbInMainThread_;
    TxCacheFile    txCache_;
    std::shared_ptr<QProcess>  armoryProcess_;
+   std::unique_ptr<TxCacheACT>   act_;
 };
 
 #endif // ARMORY_OBJECT_H
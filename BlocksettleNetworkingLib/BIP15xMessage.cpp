@@ -8,11 +8,20 @@
 **********************************************************************************
 
 */
+#include <algorithm>
 #include "BIP15xMessage.h"
 #include "BIP15x_Handshake.h"
 
 using namespace bs::network::bip15x;
 
+namespace {
+
+   // Memory is not reserved for the whole peer's announced size at once,
+   // the buffer grows as chunks arrive
+   const uint64_t kMaxChunkedReserve = 16 * ChunkSize;
+
+} // namespace
+
 void MessageBuilder::construct(const uint8_t *data, uint32_t dataSize, ArmoryAEAD::BIP151_PayloadType type)
 {
    construct(data, dataSize, (uint8_t)type);
@@ -85,6 +94,138 @@ BinaryData MessageBuilder::build() const
    return packet_;
 }
 
+void MessageBuilder::buildInto(std::string &output, const uint8_t *data, uint32_t dataSize
+   , ArmoryAEAD::BIP151_PayloadType type, BIP151Connection *conn)
+{
+   buildInto(output, {}, data, dataSize, type, conn);
+}
+
+void MessageBuilder::buildInto(std::string &output, const std::string &prefix
+   , const uint8_t *data, uint32_t dataSize
+   , ArmoryAEAD::BIP151_PayloadType type, BIP151Connection *conn)
+{
+   const size_t headerSize = sizeof(uint32_t) + sizeof(uint8_t) + prefix.size();
+   const size_t plainTextLen = headerSize + dataSize;
+   output.resize(conn ? plainTextLen + POLY1305MACLEN : plainTextLen);
+
+   auto ptr = reinterpret_cast<uint8_t*>(&output[0]);
+   // Same layout as construct() produces
+   uint32_t packetSize = uint32_t(plainTextLen - sizeof(uint32_t));
+   std::memcpy(ptr, &packetSize, sizeof(packetSize));
+   ptr[sizeof(uint32_t)] = static_cast<uint8_t>(type);
+   if (!prefix.empty()) {
+      std::memcpy(ptr + sizeof(uint32_t) + sizeof(uint8_t), prefix.data(), prefix.size());
+   }
+   if (dataSize != 0) {
+      std::memcpy(ptr + headerSize, data, dataSize);
+   }
+
+   if (!conn) {
+      return;
+   }
+
+   // ChaCha20Poly1305 supports in-place operation (plain and cipher buffers could be the same)
+   int rc = conn->assemblePacket(ptr, plainTextLen, ptr, output.size());
+   if (rc != 0) {
+      //failed to encrypt, abort
+      throw std::runtime_error("failed to encrypt packet, aborting");
+   }
+}
+
+std::string MessageBuilder::chunkHeader(bool first, uint64_t totalSize)
+{
+   BinaryWriter w;
+   w.put_uint8_t(first ? 1 : 0);
+   if (first) {
+      w.put_var_int(totalSize);
+   }
+   return w.toString();
+}
+
+bool ChunkAssembler::add(const BinaryDataRef &chunk)
+{
+   try {
+      BinaryRefReader reader(chunk);
+      const bool first = (reader.get_uint8_t() != 0);
+      if (first) {
+         if (started_) {
+            return false;
+         }
+         totalSize_ = reader.get_var_int();
+         if (totalSize_ > maxSize_) {
+            return false;
+         }
+         started_ = true;
+         data_.clear();
+         data_.reserve(static_cast<size_t>(std::min(totalSize_, kMaxChunkedReserve)));
+      } else if (!started_) {
+         return false;
+      }
+
+      const auto size = reader.getSizeRemaining();
+      if (data_.size() + size > totalSize_) {
+         return false;
+      }
+      data_.append(reinterpret_cast<const char*>(reader.getCurrPtr()), size);
+      return true;
+   } catch (...) {
+      return false;
+   }
+}
+
+std::string ChunkAssembler::take()
+{
+   started_ = false;
+   totalSize_ = 0;
+   return std::move(data_);
+}
+
+void MessageBatch::add(const std::string &data)
+{
+   size_ += data.size();
+   messages_.push_back(data);
+}
+
+void MessageBatch::add(std::string &&data)
+{
+   size_ += data.size();
+   messages_.push_back(std::move(data));
+}
+
+void MessageBatch::serialize(std::string &output) const
+{
+   output.clear();
+   for (const auto &msg : messages_) {
+      BinaryWriter w;
+      w.put_var_int(msg.size());
+      output.append(w.toString());
+      output.append(msg);
+   }
+}
+
+void MessageBatch::clear()
+{
+   messages_.clear();
+   size_ = 0;
+}
+
+bool MessageBatch::parse(const BinaryDataRef &payload, std::vector<std::string> &messages)
+{
+   try {
+      BinaryRefReader reader(payload);
+      while (!reader.isEndOfStream()) {
+         const auto size = reader.get_var_int();
+         if (size > reader.getSizeRemaining()) {
+            return false;
+         }
+         messages.push_back(reader.get_BinaryDataRef(static_cast<uint32_t>(size)).toBinStr());
+      }
+      return true;
+   } catch (...) {
+      return false;
+   }
+}
+
 Message Message::parse(const BinaryDataRef &packet)
 {
    try {
@@ -93,25 +234,29 @@ Message Message::parse(const BinaryDataRef &packet)
       if (packetLen != reader.getSizeRemaining()) {
          return {};
       }
-      const auto type = static_cast<ArmoryAEAD::BIP151_PayloadType>(reader.get_uint8_t());
-      switch (type)
-      {
-      case ArmoryAEAD::BIP151_PayloadType::SinglePacket:
-         break;
-
-      case ArmoryAEAD::BIP151_PayloadType::Start:
-      case ArmoryAEAD::BIP151_PayloadType::PresentPubKey:
-      case ArmoryAEAD::BIP151_PayloadType::PresentPubKeyChild:
-      case ArmoryAEAD::BIP151_PayloadType::EncInit:
-      case ArmoryAEAD::BIP151_PayloadType::EncAck:
-      case ArmoryAEAD::BIP151_PayloadType::Rekey:
-      case ArmoryAEAD::BIP151_PayloadType::Challenge:
-      case ArmoryAEAD::BIP151_PayloadType::Reply:
-      case ArmoryAEAD::BIP151_PayloadType::Propose:
-         break;
-
-      default:
-         return {};
+      const uint8_t rawType = reader.get_uint8_t();
+      // Extension types are not in BIP151_PayloadType, so they are not switched on
+      const bool isExtension = (rawType == BatchSupportType)
+         || (rawType == BatchedPacketType) || (rawType == ChunkedPacketType);
+      const auto type = static_cast<ArmoryAEAD::BIP151_PayloadType>(rawType);
+      if (!isExtension) {
+         switch (type)
+         {
+         case ArmoryAEAD::BIP151_PayloadType::SinglePacket:
+         case ArmoryAEAD::BIP151_PayloadType::Start:
+         case ArmoryAEAD::BIP151_PayloadType::PresentPubKey:
+         case ArmoryAEAD::BIP151_PayloadType::PresentPubKeyChild:
+         case ArmoryAEAD::BIP151_PayloadType::EncInit:
+         case ArmoryAEAD::BIP151_PayloadType::EncAck:
+         case ArmoryAEAD::BIP151_PayloadType::Rekey:
+         case ArmoryAEAD::BIP151_PayloadType::Challenge:
+         case ArmoryAEAD::BIP151_PayloadType::Reply:
+         case ArmoryAEAD::BIP151_PayloadType::Propose:
+            break;
+
+         default:
+            return {};
+         }
       }
 
       Message result;
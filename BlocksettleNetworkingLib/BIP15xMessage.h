@@ -41,6 +41,26 @@ namespace bs {
 
          constexpr unsigned int AEAD_REKEY_INTERVAL_SECS = 600;
 
+         // Negotiated extension packet types (not part of ArmoryAEAD::BIP151_PayloadType).
+         // Sent only encrypted, after BIP 150 handshake is completed.
+         // Client announces that it accepts batched packets, server may then pack
+         // several queued messages into one AEAD record.
+         constexpr uint8_t BatchSupportType = 0x40;
+         constexpr uint8_t BatchedPacketType = 0x41;
+         // Part of a large message, see ChunkAssembler
+         constexpr uint8_t ChunkedPacketType = 0x42;
+
+         // Optional BatchSupportType payload (single byte). Empty payload means batching only.
+         constexpr uint8_t FeatureBatching = 0x01;
+         constexpr uint8_t FeatureChunking = 0x02;
+
+         // Messages above that size are sent in chunks if peer supports them,
+         // so only a chunk is encrypted/decrypted at once
+         constexpr size_t ChunkSize = 64 * 1024;
+
+         // Default limit for the size of reassembled chunked message
+         constexpr uint64_t DefaultMaxChunkedMessageSize = 512 * 1024 * 1024;
+
          // A class used to represent messages on the wire that need to be created.
          class MessageBuilder
          {
@@ -63,6 +83,20 @@ namespace bs {
             // Returns packet that is ready for send
             BinaryData build() const;
 
+            // Builds ready to send packet directly in output without intermediate buffers:
+            // header and payload are written once and encrypted in place, MAC is appended.
+            // Output is resized to exact packet size, so its capacity is reused between calls.
+            // If conn is not set packet is left plain.
+            static void buildInto(std::string &output, const uint8_t *data, uint32_t dataSize
+               , ArmoryAEAD::BIP151_PayloadType type, BIP151Connection *conn);
+            // Same as above, but payload is prefix followed by data
+            static void buildInto(std::string &output, const std::string &prefix
+               , const uint8_t *data, uint32_t dataSize
+               , ArmoryAEAD::BIP151_PayloadType type, BIP151Connection *conn);
+
+            // Returns chunk header (goes before chunk data in ChunkedPacketType payload)
+            static std::string chunkHeader(bool first, uint64_t totalSize);
+
          private:
             void construct(const uint8_t *data, uint32_t dataSize, ArmoryAEAD::BIP151_PayloadType type);
             void construct(const uint8_t *data, uint32_t dataSize, uint8_t type);
@@ -71,6 +105,55 @@ namespace bs {
             BinaryData packet_;
          };
 
+         // Messages queued to be sent in one BatchedPacket record.
+         // Payload format: ([var_int size][data])...
+         class MessageBatch
+         {
+         public:
+            void add(const std::string &data);
+            void add(std::string &&data);
+            bool empty() const { return messages_.empty(); }
+            size_t count() const { return messages_.size(); }
+            size_t size() const { return size_; }
+            const std::string &front() const { return messages_.front(); }
+
+            // Serializes queued messages to output (its capacity is reused)
+            void serialize(std::string &output) const;
+            void clear();
+
+            // Returns false if payload is malformed
+            static bool parse(const BinaryDataRef &payload, std::vector<std::string> &messages);
+
+         private:
+            std::vector<std::string> messages_;
+            size_t size_{};
+         };
+
+         // Reassembles ChunkedPacketType payloads into the full message.
+         // Chunk payload: [uint8 first] [var_int totalSize - first chunk only] [data]
+         // Message is complete when totalSize bytes are received.
+         class ChunkAssembler
+         {
+         public:
+            ChunkAssembler() = default;
+            explicit ChunkAssembler(uint64_t maxSize) : maxSize_(maxSize) {}
+
+            // Messages announcing bigger total size are rejected
+            void setMaxSize(uint64_t maxSize) { maxSize_ = maxSize; }
+
+            // Returns false on protocol violation
+            bool add(const BinaryDataRef &chunk);
+            bool complete() const { return started_ && (data_.size() == totalSize_); }
+            // Returns complete message and resets the state
+            std::string take();
+
+         private:
+            std::string data_;
+            uint64_t totalSize_{};
+            uint64_t maxSize_{ DefaultMaxChunkedMessageSize };
+            bool started_{ false };
+         };
+
          // A class used to represent messages on the wire that need to be decrypted.
          class Message
          {
@@ -90,8 +90,8 @@ Bip15xDataConnection::Bip15xDataConnection(const std::shared_ptr<spdlog::logger>
       return conn_->send(d);
    });
 
-   transport_->setNotifyDataCb([this](const std::string &d) {
-      listener_->OnDataReceived(d);
+   transport_->setNotifyDataCb([this](std::string d) {
+      listener_->OnDataReceivedOwned(std::move(d));
    });
 
    transport_->setSocketErrorCb([this](DataConnectionListener::DataConnectionError e) {
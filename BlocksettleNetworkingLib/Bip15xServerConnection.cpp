@@ -73,14 +73,16 @@ Bip15xServerConnection::Bip15xServerConnection(const std::shared_ptr<spdlog::log
    , server_(std::move(server))
    , transport_(tr)
 {
+   server_->disableSessionRestore();
+
    transport_->setClientErrorCb([this](const std::string &id
       , ServerConnectionListener::ClientError err
       , const ServerConnectionListener::Details &details) {
       listener_->onClientError(id, err, details);
    });
 
-   transport_->setDataReceivedCb([this](const std::string &clientId, const std::string &data) {
-      listener_->OnDataFromClient(clientId, data);
+   transport_->setDataReceivedCb([this](const std::string &clientId, std::string data) {
+      listener_->OnDataFromClientOwned(clientId, std::move(data));
    });
 
    transport_->setSendDataCb([this](const std::string &clientId, const std::string &data) {
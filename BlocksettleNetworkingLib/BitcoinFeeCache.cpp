@@ -11,19 +11,32 @@
 #include "BitcoinFeeCache.h"
 
 #include "ArmoryConnection.h"
+#include "BinaryData.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
 
 #include <QtGlobal>
 
 static constexpr auto kCacheValueExpireTimeout = std::chrono::hours(1);
+// Expired value is still returned (while refreshing) if it is not older than this
+static constexpr auto kCacheValueMaxStaleTime = std::chrono::hours(6);
 // 200 s/b
 static constexpr float kFallbackFeeAmount = 200;
+// Refresh is started again if Armory did not reply (e.g. connection was lost)
+static constexpr auto kRefreshTimeout = std::chrono::seconds(30);
 
 
 BitcoinFeeCache::BitcoinFeeCache(const std::shared_ptr<spdlog::logger> &logger
-   , const std::shared_ptr<ArmoryConnection> &armory)
+   , const std::shared_ptr<ArmoryConnection> &armory
+   , const std::string &cacheFileName)
  : logger_{logger}
  , armory_{armory}
+ , cacheFileName_{cacheFileName}
 {
+   loadCache();
 }
 
 //fee = ArmoryConnection::toFeePerByte(fee);
@@ -37,37 +50,50 @@ bool BitcoinFeeCache::getFeePerByteEstimation(unsigned int blocksToWait, const f
 
    bool  estimateScheduled = false;
    float result = 0;
+   bool  joinFallback = false;
+   uint64_t generation = 0;
 
    {
       std::lock_guard<std::mutex> lock(cacheMutex_);
+      trackedTargets_.insert(blocksToWait);
+
+      if (refreshPending_ && (std::chrono::steady_clock::now() - refreshStartTime_ > kRefreshTimeout)) {
+         logger_->warn("[BitcoinFeeCache::getFeePerByteEstimation] fee refresh timed out, restarting");
+         refreshPending_ = false;
+         fallbackTargets_.clear();
+         fallbackRequests_ = 0;
+      }
 
       auto it = estimationsCache_.find(blocksToWait);
-      if ((it == estimationsCache_.end()) || cacheValueExpired(it->second.estimationTimestamp)) {
-         auto it = pendingCB_.find(blocksToWait);
+      if ((it != estimationsCache_.end())
+         && !cacheValueExpired(it->second.estimationTimestamp, kCacheValueMaxStaleTime)) {
+         result = it->second.feeEstimation;
 
+         if (cacheValueExpired(it->second.estimationTimestamp, kCacheValueExpireTimeout)
+            && !refreshPending_) {
+            startRefresh();
+         }
+      } else {
          estimateScheduled = true;
+         pendingCB_[blocksToWait].emplace_back(cb);
 
-         if (it == pendingCB_.end()) {
-            pendingCB_.emplace(blocksToWait, std::vector<feeCB>{ cb });
-
-            auto cbWrap = [this, blocksToWait](float fee) {
-               setFeeEstimationValue(blocksToWait, ArmoryConnection::toFeePerByte(fee));
-            };
-
-            if (!armory_->estimateFee(blocksToWait, cbWrap)) {
+         if (!refreshPending_) {
+            if (!startRefresh()) {
                pendingCB_.erase(blocksToWait);
                return false;
             }
-
-         } else {
-            it->second.emplace_back(cb);
+         } else if (!fallbackTargets_.empty() && fallbackTargets_.insert(blocksToWait).second) {
+            // Fallback was started without this target, so it's estimated separately
+            ++fallbackRequests_;
+            joinFallback = true;
+            generation = refreshGeneration_;
          }
-      } else {
-         estimateScheduled = false;
-         result = it->second.feeEstimation;
       }
    }
 
+   if (joinFallback) {
+      estimateTarget(blocksToWait, generation);
+   }
    if (!estimateScheduled) {
       cb(result);
    }
@@ -75,34 +101,129 @@ bool BitcoinFeeCache::getFeePerByteEstimation(unsigned int blocksToWait, const f
    return true;
 }
 
-void BitcoinFeeCache::setFeeEstimationValue(const unsigned int blocksToWait, float fee)
+bool BitcoinFeeCache::startRefresh()
 {
-   std::vector<feeCB> userCB;
+   const auto generation = ++refreshGeneration_;
+   const auto cbSchedule = [this, generation](const std::map<unsigned int, float> &schedule) {
+      onFeeSchedule(schedule, generation);
+   };
+   refreshStartTime_ = std::chrono::steady_clock::now();
+   refreshPending_ = armory_->getFeeSchedule(cbSchedule);
+   return refreshPending_;
+}
+
+void BitcoinFeeCache::onFeeSchedule(const std::map<unsigned int, float> &schedule, uint64_t generation)
+{
+   if (schedule.empty()) {
+      logger_->warn("[BitcoinFeeCache::onFeeSchedule] empty fee schedule, estimate each target");
+      estimateEachTarget(generation);
+      return;
+   }
 
+   std::vector<std::pair<float, std::vector<feeCB>>> userCB;
    {
       std::lock_guard<std::mutex> lock(cacheMutex_);
 
-      if (qFuzzyIsNull(fee) || qIsInf(fee)) {
-         fee = kFallbackFeeAmount;
-      } else {
-         FeeEstimationCache currentValue;
-         currentValue.feeEstimation = fee;
-         currentValue.estimationTimestamp = std::chrono::system_clock::now();
+      for (const auto blocksToWait : trackedTargets_) {
+         // Schedule has a fixed set of targets, take the closest one not slower than requested
+         auto it = schedule.upper_bound(blocksToWait);
+         if (it != schedule.begin()) {
+            --it;
+         }
+         std::vector<feeCB> cbs;
+         const auto fee = updateEstimation(blocksToWait, ArmoryConnection::toFeePerByte(it->second), cbs);
+         if (!cbs.empty()) {
+            userCB.emplace_back(fee, std::move(cbs));
+         }
+      }
+      if (generation == refreshGeneration_) {
+         refreshPending_ = false;
+      }
+   }
 
-         estimationsCache_[blocksToWait] = currentValue;
+   saveCache();
+
+   for (const auto &item : userCB) {
+      for (const auto &cb : item.second) {
+         cb(item.first);
       }
+   }
+}
+
+void BitcoinFeeCache::estimateEachTarget(uint64_t generation)
+{
+   std::set<unsigned int> targets;
+   {
+      std::lock_guard<std::mutex> lock(cacheMutex_);
+      if (generation != refreshGeneration_) {
+         return;  // timed out, other refresh was started already
+      }
+      targets = trackedTargets_;
+      fallbackTargets_ = targets;
+      fallbackRequests_ = targets.size();
+      if (targets.empty()) {
+         refreshPending_ = false;
+         return;
+      }
+   }
+
+   for (const auto blocksToWait : targets) {
+      estimateTarget(blocksToWait, generation);
+   }
+}
+
+void BitcoinFeeCache::estimateTarget(unsigned int blocksToWait, uint64_t generation)
+{
+   auto cbWrap = [this, blocksToWait, generation](float fee) {
+      setFeeEstimationValue(blocksToWait, ArmoryConnection::toFeePerByte(fee), generation);
+   };
+
+   if (!armory_->estimateFee(blocksToWait, cbWrap)) {
+      setFeeEstimationValue(blocksToWait, 0, generation);
+   }
+}
+
+float BitcoinFeeCache::updateEstimation(unsigned int blocksToWait, float fee, std::vector<feeCB> &userCB)
+{
+   if (qFuzzyIsNull(fee) || qIsInf(fee)) {
+      fee = kFallbackFeeAmount;
+   } else {
+      FeeEstimationCache currentValue;
+      currentValue.feeEstimation = fee;
+      currentValue.estimationTimestamp = std::chrono::system_clock::now();
+
+      estimationsCache_[blocksToWait] = currentValue;
+   }
+
+   auto cbIt = pendingCB_.find(blocksToWait);
+   if (cbIt != pendingCB_.end()) {
+      userCB = std::move(cbIt->second);
+
+      pendingCB_.erase(cbIt);
+   }
+   return fee;
+}
 
-      auto cbIt = pendingCB_.find(blocksToWait);
-      if (cbIt != pendingCB_.end()) {
-         userCB = std::move(cbIt->second);
+void BitcoinFeeCache::setFeeEstimationValue(const unsigned int blocksToWait, float fee
+   , uint64_t generation)
+{
+   std::vector<feeCB> userCB;
+   bool completed = false;
+
+   {
+      std::lock_guard<std::mutex> lock(cacheMutex_);
 
-         pendingCB_.erase(cbIt);
+      fee = updateEstimation(blocksToWait, fee, userCB);
+
+      if ((generation == refreshGeneration_) && fallbackRequests_ && (--fallbackRequests_ == 0)) {
+         refreshPending_ = false;
+         fallbackTargets_.clear();
+         completed = true;
       }
    }
 
-   if (userCB.empty()) {
-      logger_->error("[BitcoinFeeCache::setFeeEstimationValue] no CB saved for {} blocks"
-         , blocksToWait);
+   if (completed) {
+      saveCache();
    }
 
    for (const auto& cb : userCB) {
@@ -110,7 +231,79 @@ void BitcoinFeeCache::setFeeEstimationValue(const unsigned int blocksToWait, flo
    }
 }
 
-bool BitcoinFeeCache::cacheValueExpired(const std::chrono::system_clock::time_point& timestamp) const
+bool BitcoinFeeCache::cacheValueExpired(const std::chrono::system_clock::time_point& timestamp
+   , std::chrono::system_clock::duration timeout) const
 {
-   return (std::chrono::system_clock::now() - timestamp) > kCacheValueExpireTimeout;
+   return (std::chrono::system_clock::now() - timestamp) > timeout;
+}
+
+void BitcoinFeeCache::loadCache()
+{
+   if (cacheFileName_.empty()) {
+      return;
+   }
+   std::ifstream file(cacheFileName_, std::ios::in | std::ios::binary);
+   if (!file.is_open()) {
+      return;
+   }
+   const std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+   try {
+      BinaryRefReader reader(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+      const auto count = reader.get_var_int();
+      for (uint64_t i = 0; i < count; ++i) {
+         const auto blocksToWait = static_cast<unsigned int>(reader.get_var_int());
+         const auto feeBits = reader.get_uint32_t();
+         const auto timestampMs = reader.get_uint64_t();
+
+         FeeEstimationCache value;
+         std::memcpy(&value.feeEstimation, &feeBits, sizeof(feeBits));
+         value.estimationTimestamp = std::chrono::system_clock::time_point(
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(
+               std::chrono::milliseconds(timestampMs)));
+         estimationsCache_[blocksToWait] = value;
+      }
+   } catch (const std::exception &e) {
+      logger_->error("[BitcoinFeeCache::loadCache] invalid cache file {}: {}", cacheFileName_, e.what());
+      estimationsCache_.clear();
+   }
+}
+
+void BitcoinFeeCache::saveCache()
+{
+   if (cacheFileName_.empty()) {
+      return;
+   }
+
+   BinaryWriter writer;
+   {
+      std::lock_guard<std::mutex> lock(cacheMutex_);
+      writer.put_var_int(estimationsCache_.size());
+      for (const auto &item : estimationsCache_) {
+         uint32_t feeBits;
+         std::memcpy(&feeBits, &item.second.feeEstimation, sizeof(feeBits));
+         writer.put_var_int(item.first);
+         writer.put_uint32_t(feeBits);
+         writer.put_uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(
+            item.second.estimationTimestamp.time_since_epoch()).count());
+      }
+   }
+
+   std::lock_guard<std::mutex> lock(saveMutex_);
+   const auto tmpFileName = cacheFileName_ + ".tmp";
+   {
+      std::ofstream file(tmpFileName, std::ios::out | std::ios::binary | std::ios::trunc);
+      const auto data = writer.toString();
+      file.write(data.data(), data.size());
+      if (!file.good()) {
+         logger_->error("[BitcoinFeeCache::saveCache] failed to write {}", tmpFileName);
+         return;
+      }
+   }
+#ifdef WIN32
+   std::remove(cacheFileName_.c_str());
+#endif
+   if (std::rename(tmpFileName.c_str(), cacheFileName_.c_str()) != 0) {
+      logger_->error("[BitcoinFeeCache::saveCache] failed to rename {}", tmpFileName);
+   }
 }
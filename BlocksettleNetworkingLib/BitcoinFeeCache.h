@@ -13,19 +13,25 @@
 
 #include <spdlog/spdlog.h>
 
+#include <map>
 #include <memory>
 #include <mutex>
 #include <chrono>
+#include <set>
 #include <unordered_map>
 #include <vector>
 
 class ArmoryConnection;
 
+// Expired estimations are returned immediately and refreshed in background (stale-while-revalidate).
+// All requested targets are refreshed with a single Armory fee schedule request.
+// If cacheFileName is set, last estimations are saved there and loaded on start.
 class BitcoinFeeCache
 {
 public:
    BitcoinFeeCache(const std::shared_ptr<spdlog::logger> &logger
-                   , const std::shared_ptr<ArmoryConnection> &armory);
+                   , const std::shared_ptr<ArmoryConnection> &armory
+                   , const std::string &cacheFileName = {});
    ~BitcoinFeeCache() noexcept = default;
 
    BitcoinFeeCache(const BitcoinFeeCache&) = delete;
@@ -40,13 +46,25 @@ public:
    bool getFeePerByteEstimation(unsigned int blocksToWait, const feeCB& cb);
 
 private:
-   bool cacheValueExpired(const std::chrono::system_clock::time_point& timestamp) const;
+   bool cacheValueExpired(const std::chrono::system_clock::time_point& timestamp
+      , std::chrono::system_clock::duration timeout) const;
 
-   void setFeeEstimationValue(const unsigned int blocksToWait, float fee);
+   // Should be called with cacheMutex_ locked
+   bool startRefresh();
+   float updateEstimation(unsigned int blocksToWait, float fee, std::vector<feeCB> &userCB);
+
+   void onFeeSchedule(const std::map<unsigned int, float> &schedule, uint64_t generation);
+   void estimateEachTarget(uint64_t generation);
+   void estimateTarget(unsigned int blocksToWait, uint64_t generation);
+   void setFeeEstimationValue(const unsigned int blocksToWait, float fee, uint64_t generation);
+
+   void loadCache();
+   void saveCache();
 
 private:
    std::shared_ptr<spdlog::logger>     logger_;
    std::shared_ptr<ArmoryConnection>   armory_;
+   const std::string                   cacheFileName_;
 
 
    struct FeeEstimationCache
@@ -58,6 +76,16 @@ private:
    std::mutex                                            cacheMutex_;
    std::unordered_map<unsigned int, FeeEstimationCache>  estimationsCache_;
    std::unordered_map<unsigned int, std::vector<feeCB>>  pendingCB_;
+   std::set<unsigned int>                                trackedTargets_;
+   bool                                                  refreshPending_{ false };
+   // Replies of refreshes abandoned on timeout update the cache, but don't complete current refresh
+   uint64_t                                              refreshGeneration_{};
+   std::chrono::steady_clock::time_point                 refreshStartTime_;
+   // Targets estimated one by one (if fee schedule was empty), and replies still expected
+   std::set<unsigned int>                                fallbackTargets_;
+   size_t                                                fallbackRequests_{};
+
+   std::mutex                                            saveMutex_;
 };
 
 #endif
@@ -8,9 +8,17 @@
 **********************************************************************************
 
 */
+#include <algorithm>
 #include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <shared_mutex>
+#include <string_view>
 #include <QtConcurrent/QtConcurrentRun>
 #include "CacheFile.h"
+#include "SystemFileUtils.h"
 
 namespace {
 
@@ -22,19 +30,244 @@ namespace {
    // From LMDB docs: The size should be a multiple of the OS page size
    const size_t kCacheFileMapSize = 150*1024*1024;
 
+   // LMDB could preallocate the whole map (Windows), so smaller files can't be shrunk
+   const size_t kMinCompactFileSize = kCacheFileMapSize;
+   // Leaf node header and page index slot of each entry
+   const size_t kEntryOverhead = 10;
+
+   size_t fileSize(const std::string &filename)
+   {
+      std::ifstream file(filename, std::ios::in | std::ios::binary | std::ios::ate);
+      if (!file.is_open()) {
+         return 0;
+      }
+      return static_cast<size_t>(file.tellg());
+   }
+
+   const size_t kBloomBitsPerElem = 10;
+   const size_t kBloomNbHashes = 7;    // ~1% false positives when filled up to its capacity
+
+   // Short, as unknown TX could appear in mempool soon
+   const auto kUnknownTxTimeout = std::chrono::seconds(10);
+   const size_t kMaxUnknownTxs = 10000;
+
+   // lmdbpp doesn't keep LMDB error code in its exceptions, only mdb_strerror() text of it
+   // ("MDB_MAP_FULL: Environment mapsize limit reached"), possibly after operation description.
+   // LMDB's own message is looked for, so the check doesn't depend on its exact wording.
+   bool isMapFull(const std::exception &e)
+   {
+      static const std::string mapFullText = mdb_strerror(MDB_MAP_FULL);
+      return (std::strstr(e.what(), mapFullText.c_str()) != nullptr);
+   }
+
+   struct BinaryDataHash
+   {
+      size_t operator()(const BinaryData &key) const
+      {
+         return std::hash<std::string_view>()(std::string_view(
+            reinterpret_cast<const char *>(key.getPtr()), key.getSize()));
+      }
+   };
+
 } // namespace
 
-CacheFile::CacheFile(const std::string &filename, size_t nbElemLimit)
-   : inMem_(filename.empty())
-   , nbMaxElems_(nbElemLimit)
+// Bits are only set (never cleared), so lookups need no locks. Keys evicted from cache
+// remain in the filter until it's rebuilt on next open.
+struct CacheFile::BloomFilter
 {
+   explicit BloomFilter(size_t nbElems)
+      : words(std::max<size_t>(nbElems * kBloomBitsPerElem / 64, 1))
+   {}
+
+   void add(const BinaryData &key)
+   {
+      uint64_t h1, h2;
+      hashes(key, h1, h2);
+      for (size_t i = 0; i < kBloomNbHashes; ++i) {
+         const auto bit = (h1 + i * h2) % (words.size() * 64);
+         words[bit / 64].fetch_or(uint64_t(1) << (bit % 64), std::memory_order_relaxed);
+      }
+   }
+
+   bool mayContain(const BinaryData &key) const
+   {
+      uint64_t h1, h2;
+      hashes(key, h1, h2);
+      for (size_t i = 0; i < kBloomNbHashes; ++i) {
+         const auto bit = (h1 + i * h2) % (words.size() * 64);
+         if (!(words[bit / 64].load(std::memory_order_relaxed) & (uint64_t(1) << (bit % 64)))) {
+            return false;
+         }
+      }
+      return true;
+   }
+
+   static void hashes(const BinaryData &key, uint64_t &h1, uint64_t &h2)
+   {  // double hashing: second hash is derived from the first one and should be odd
+      h1 = BinaryDataHash()(key);
+      h2 = ((h1 * 0x9E3779B97F4A7C15ull) ^ (h1 >> 29)) | 1;
+   }
+
+   std::vector<std::atomic<uint64_t>>  words;
+};
+
+struct CacheFile::Shard
+{
+   struct Entry
+   {
+      explicit Entry(const std::shared_ptr<const BinaryData> &val) : value(val) {}
+
+      size_t size() const { return value->getSize() + objectSize; }
+
+      std::shared_ptr<const BinaryData>   value;
+      std::shared_ptr<const void>         object;     // parsed value, if any
+      size_t   objectSize{ 0 };
+      // Set on insert and access, cleared by eviction sweep, so readers need only shared lock
+      mutable std::atomic_bool   referenced{ true };
+   };
+
+   mutable std::shared_mutex  mutex;
+   std::unordered_map<BinaryData, Entry, BinaryDataHash> map;
+   std::deque<BinaryData>     queue;      // keys in insertion order for eviction sweep
+   std::map<BinaryData, std::shared_ptr<const BinaryData>> modified;   // not yet saved to LMDB
+   // Taken from modified by the running flush, kept visible until its commit is finished
+   std::map<BinaryData, std::shared_ptr<const BinaryData>> inFlight;
+   size_t   nbBytes{ 0 };
+   size_t   maxElems{ 0 };
+   size_t   maxBytes{ 0 };
+
+   std::atomic<uint64_t>   hits{ 0 };
+   std::atomic<uint64_t>   misses{ 0 };
+   std::atomic<uint64_t>   diskReads{ 0 };
+   uint64_t                evictions{ 0 };
+
+   // Should be called with at least shared lock
+   bool find(const BinaryData &key, CachedEntry &entry) const
+   {
+      const auto it = map.find(key);
+      if (it != map.end()) {
+         it->second.referenced = true;
+         entry = { it->second.value, it->second.object, it->second.objectSize };
+         return true;
+      }
+      const auto itModif = modified.find(key);
+      if (itModif != modified.end()) {
+         entry = { itModif->second, nullptr };
+         return true;
+      }
+      const auto itInFlight = inFlight.find(key);
+      if (itInFlight != inFlight.end()) {
+         entry = { itInFlight->second, nullptr };
+         return true;
+      }
+      return false;
+   }
+
+   // Methods below should be called with exclusive lock
+   void insert(const BinaryData &key, const std::shared_ptr<const BinaryData> &val
+      , const std::shared_ptr<const void> &object = nullptr, size_t objectSize = 0)
+   {
+      auto it = map.find(key);
+      if (it == map.end()) {
+         it = map.emplace(std::piecewise_construct, std::forward_as_tuple(key)
+            , std::forward_as_tuple(val)).first;
+         queue.push_back(key);
+         nbBytes += key.getSize();
+      }
+      else {
+         nbBytes -= it->second.size();
+         it->second.value = val;
+         it->second.referenced = true;
+      }
+      it->second.object = object;
+      it->second.objectSize = object ? objectSize : 0;
+      nbBytes += it->second.size();
+   }
+
+   bool overLimit() const
+   {
+      return (map.size() > maxElems) || (maxBytes && (nbBytes > maxBytes));
+   }
+
+   // Second chance: recently accessed entries are moved to the end of the queue.
+   // Entries not saved to LMDB yet are kept, so nothing could be evicted until next flush.
+   bool evictOne(BinaryData &key)
+   {
+      // Two rounds are enough to clear all referenced bits
+      for (size_t nbSkipped = 0, maxSkipped = 2 * queue.size(); !queue.empty(); ) {
+         const auto it = map.find(queue.front());
+         if (it == map.end()) {
+            queue.pop_front();
+            continue;
+         }
+         if (it->second.referenced.exchange(false) || modified.count(it->first)
+            || inFlight.count(it->first)) {
+            if (++nbSkipped > maxSkipped) {
+               return false;
+            }
+            queue.push_back(std::move(queue.front()));
+            queue.pop_front();
+            continue;
+         }
+         nbBytes -= it->first.getSize() + it->second.size();
+         key = std::move(queue.front());
+         queue.pop_front();
+         map.erase(it);
+         ++evictions;
+         return true;
+      }
+      return false;
+   }
+};
+
+CacheFile::CacheFile(const std::string &filename, size_t nbElemLimit, size_t byteLimit)
+   : CacheFile(filename, CacheFileParams{ nbElemLimit, byteLimit })
+{}
+
+CacheFile::CacheFile(const std::string &filename, const CacheFileParams &params)
+   : filename_(filename)
+   , inMem_(filename.empty())
+   , lazyLoad_(params.lazyLoad && !filename.empty())
+   , nbMaxElems_(params.nbElemLimit)
+   , maxBytes_(params.byteLimit)
+   , diskMaxElems_(params.diskElemLimit ? params.diskElemLimit : params.nbElemLimit)
+   , diskMaxBytes_(params.diskByteLimit ? params.diskByteLimit : params.byteLimit)
+   , flushInterval_(params.flushInterval)
+   , flushBatchSize_(std::max<size_t>(params.flushBatchSize, 1))
+   , maxMapSize_(std::max(params.maxMapSize, kCacheFileMapSize))
+   , compactRatio_(params.compactRatio)
+{
+   const auto nbShards = std::max<size_t>(params.nbShards, 1);
+   for (size_t i = 0; i < nbShards; ++i) {
+      auto shard = std::make_unique<Shard>();
+      shard->maxElems = std::max<size_t>((nbMaxElems_ + nbShards - 1) / nbShards, 1);
+      shard->maxBytes = (maxBytes_ + nbShards - 1) / nbShards;
+      shards_.push_back(std::move(shard));
+   }
+
    if (!inMem_) {
-      dbEnv_ = std::make_shared<LMDBEnv>();
-      dbEnv_->open(filename);
-      dbEnv_->setMapSize(kCacheFileMapSize);
-      db_ = new LMDB(dbEnv_.get(), "cache");
+      switch (params.syncMode) {
+      case CacheFileSync::NoMetaSync:
+         envFlags_ = MDB_NOMETASYNC;
+         break;
+      case CacheFileSync::NoSync:
+         envFlags_ = MDB_NOSYNC;
+         break;
+      default: break;
+      }
+      openDb();
 
-      read();
+      if (!lazyLoad_) {
+         read();
+      }
+   }
+   if (params.bloomFilter) {
+      // Twice the expected number of keys, as new ones are added without eviction
+      bloom_ = std::make_unique<BloomFilter>(std::max(nbMaxElems_, diskMaxElems_) * 2);
+   }
+   if (inMem_) {
+      bloomReady_ = true;  // nothing to scan
+   } else {
       thread_ = std::thread([this] { saver(); });
    }
 }
@@ -51,6 +284,16 @@ CacheFile::~CacheFile()
    }
 }
 
+void CacheFile::openDb()
+{
+   dbEnv_ = std::make_shared<LMDBEnv>();
+   dbEnv_->open(filename_, envFlags_);
+   // Existing file could be already grown above the default map size
+   mapSize_ = std::max(kCacheFileMapSize, fileSize(filename_));
+   dbEnv_->setMapSize(mapSize_);
+   db_ = new LMDB(dbEnv_.get(), "cache");
+}
+
 void CacheFile::stop()
 {
    stopped_ = true;
@@ -68,9 +311,19 @@ void CacheFile::stop()
 
 #define DB_PREFIX    0xDC
 
+size_t CacheFile::shardIndex(const BinaryData &key) const
+{  // high bits are used, as low ones select bucket inside shard's map
+   const uint64_t hash = BinaryDataHash()(key);
+   return (hash >> 32) % shards_.size();
+}
+
+CacheFile::Shard &CacheFile::shardOf(const BinaryData &key) const
+{
+   return *shards_[shardIndex(key)];
+}
+
 void CacheFile::read()
-{  // use write lock, as we're writing to in-mem map here, not reading it
-   std::unique_lock<std::mutex> lock(rwMutex_);
+{
    LMDBEnv::Transaction tx(dbEnv_.get(), LMDB::ReadOnly);
    auto dbIter = db_->begin();
 
@@ -98,139 +351,742 @@ void CacheFile::read()
       const BinaryData key(brrKey.getCurrPtr(), brrKey.getSizeRemaining());
 
       BinaryRefReader brrVal(valueBDR);
-      const BinaryData value(brrVal.getCurrPtr(), brrVal.getSizeRemaining());
+      const auto value = std::make_shared<const BinaryData>(brrVal.getCurrPtr(), brrVal.getSizeRemaining());
       if (!key.empty()) {
-         map_.emplace(key, value);
+         auto &shard = shardOf(key);
+         std::unique_lock<std::shared_mutex> lock(shard.mutex);
+         shard.insert(key, value);
       }
 
       dbIter.advance();
    }
 }
 
-void CacheFile::write()
+// Runs on saver thread before the first flush, so the file is not modified meanwhile.
+// Keys put concurrently are added to the filter by putLocked().
+void CacheFile::scan(size_t &nbElems, size_t &nbBytes)
 {
-   std::unique_lock<std::mutex> lock(rwMutex_);
-   LMDBEnv::Transaction tx(dbEnv_.get(), LMDB::ReadWrite);
-   std::unique_lock<std::mutex> lockModif(cvMutex_);
-   for (const auto &entry : mapModified_) {
+   nbElems = 0;
+   nbBytes = 0;
+   if (lazyLoad_) {  // only keys and value sizes are read from the file
+      LMDBEnv::Transaction tx(dbEnv_.get(), LMDB::ReadOnly);
+      auto dbIter = db_->begin();
+
       BinaryWriter bwKey;
       bwKey.put_uint8_t(DB_PREFIX);
-      bwKey.put_BinaryData(entry.first);
+      CharacterArrayRef keyRef(bwKey.getSize(), bwKey.getData().getPtr());
 
-      CharacterArrayRef keyRef(bwKey.getData().getSize(), bwKey.getData().getPtr());
-      CharacterArrayRef dataRef(entry.second.getSize(), entry.second.getPtr());
-      db_->insert(keyRef, dataRef);
-      map_[entry.first] = entry.second;
+      for (dbIter.seek(keyRef, LMDB::Iterator::Seek_GE); dbIter.isValid() && !stopped_; dbIter.advance()) {
+         const auto iterkey = dbIter.key();
+         if ((iterkey.mv_size < 2) || (*static_cast<const uint8_t *>(iterkey.mv_data) != DB_PREFIX)) {
+            break;
+         }
+         ++nbElems;
+         nbBytes += iterkey.mv_size + dbIter.value().mv_size;
+         if (bloom_) {
+            bloom_->add(BinaryData(static_cast<const uint8_t *>(iterkey.mv_data) + 1, iterkey.mv_size - 1));
+         }
+      }
+      diskElems_ = nbElems;
+      diskBytes_ = nbBytes;
+   } else {    // file contents were loaded on open
+      for (const auto &shard : shards_) {
+         std::shared_lock<std::shared_mutex> lock(shard->mutex);
+         nbElems += shard->map.size();
+         for (const auto &entry : shard->map) {
+            nbBytes += 1 + entry.first.getSize() + entry.second.value->getSize();
+            if (bloom_) {
+               bloom_->add(entry.first);
+            }
+         }
+      }
+   }
+   if (!stopped_) {
+      bloomReady_ = true;
    }
-   mapModified_.clear();
 }
 
-void CacheFile::saver()
+bool CacheFile::rejectedByBloom(const BinaryData &key)
 {
-   const std::chrono::duration<double> minSaveDuration(23.0);
-   size_t nbElemsThreshold = 100;
-   auto start = std::chrono::system_clock::now();
+   if (!bloom_ || !bloomReady_ || bloom_->mayContain(key)) {
+      return false;
+   }
+   ++bloomRejects_;
+   return true;
+}
 
-   while (!stopped_) {
-      purge();
+void CacheFile::write()
+{
+   std::vector<std::pair<BinaryData, std::shared_ptr<const BinaryData>>> queue;
+   for (const auto &shard : shards_) {
+      std::unique_lock<std::shared_mutex> lock(shard->mutex);
+      for (const auto &entry : shard->modified) {
+         queue.emplace_back(entry.first, entry.second);
+      }
+      queueDepth_ -= shard->modified.size();
+      shard->inFlight = std::move(shard->modified);
+      shard->modified.clear();
+   }
+   if (queue.empty()) {
+      return;
+   }
 
-      {
-         std::unique_lock<std::mutex> lock(cvMutex_);
-         cvSave_.wait_for(lock, std::chrono::seconds{ 123 });
+   // Shard locks are not held here - purge and write run on the saver thread only.
+   // Each transaction is committed separately to keep writer latency bounded.
+   const auto start = std::chrono::steady_clock::now();
+   for (size_t i = 0; i < queue.size(); ) {
+      const auto end = std::min(i + flushBatchSize_, queue.size());
+      bool mapFull = false;
+      if (!writeBatch(queue, i, end, mapFull)) {
+         if (mapFull && growMap()) {
+            continue;   // the same batch is retried with bigger map
+         }
+         writeErrors_ += end - i;
       }
-      if (stopped_ || mapModified_.empty()) {
-         continue;
+      i = end;
+   }
+   for (const auto &shard : shards_) {
+      std::unique_lock<std::shared_mutex> lock(shard->mutex);
+      shard->inFlight.clear();
+   }
+
+   const uint64_t durationMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start).count();
+   ++flushes_;
+   flushDurationMs_ += durationMs;
+   if (durationMs > maxFlushDurationMs_) {
+      maxFlushDurationMs_ = durationMs;
+   }
+}
+
+bool CacheFile::writeBatch(const std::vector<std::pair<BinaryData, std::shared_ptr<const BinaryData>>> &queue
+   , size_t begin, size_t end, bool &mapFull)
+{
+   size_t addedElems = 0;
+   size_t addedBytes = 0;
+   size_t removedBytes = 0;
+   LMDBEnv::Transaction tx(dbEnv_.get(), LMDB::ReadWrite);
+   try {
+      for (size_t i = begin; i < end; ++i) {
+         BinaryWriter bwKey;
+         bwKey.put_uint8_t(DB_PREFIX);
+         bwKey.put_BinaryData(queue[i].first);
+
+         CharacterArrayRef keyRef(bwKey.getData().getSize(), bwKey.getData().getPtr());
+         CharacterArrayRef dataRef(queue[i].second->getSize(), queue[i].second->getPtr());
+         if (lazyLoad_) {  // overwritten entries are not counted twice
+            const auto prevRef = db_->get_NoCopy(keyRef);
+            if (prevRef.data) {
+               removedBytes += keyRef.len + prevRef.len;
+            } else {
+               ++addedElems;
+            }
+            addedBytes += keyRef.len + dataRef.len;
+         }
+         db_->insert(keyRef, dataRef);
       }
+      tx.commit();
+   } catch (const std::exception &e) {
+      tx.rollback();
+      mapFull = isMapFull(e);
+      return false;
+   }
+   diskElems_ += addedElems;
+   diskBytes_ += addedBytes;
+   diskBytes_ -= removedBytes;
+   return true;
+}
 
-      auto curTime = std::chrono::system_clock::now();
-      std::chrono::duration<double> diff = curTime - start;
-      if ((diff < minSaveDuration) && (mapModified_.size() < nbElemsThreshold)) {
-         continue;
+bool CacheFile::growMap()
+{
+   if (mapSize_ >= maxMapSize_) {
+      return false;
+   }
+   // Called from saver thread after its transaction is finished
+   std::unique_lock<std::shared_mutex> lock(dbMutex_);
+   mapSize_ = std::min(mapSize_ * 2, maxMapSize_);
+   dbEnv_->setMapSize(mapSize_);
+   ++mapResizes_;
+   return true;
+}
+
+// lmdbpp exposes neither mdb_env_copy2(MDB_CP_COMPACT) nor mdb_env_stat() page counts,
+// so space used by live entries is estimated from their sizes counted by scan(), and
+// they are copied to the new file. Runs on saver thread before the first flush.
+void CacheFile::compact(size_t nbElems, size_t nbBytes)
+{
+   const auto size = fileSize(filename_);
+   // Pages of B-tree filled in random key order are about half full, so a healthy file takes
+   // up to twice the size of its entries. Freshly compacted file has full pages and is not
+   // compacted again until it grows a few times.
+   const auto usedSize = 2 * (nbBytes + nbElems * kEntryOverhead);
+   if ((size <= kMinCompactFileSize) || (usedSize >= size * compactRatio_)) {
+      return;
+   }
+   const auto tmpFilename = filename_ + ".compact";
+   SystemFileUtils::rmFile(tmpFilename);
+
+   try {
+      auto tmpEnv = std::make_shared<LMDBEnv>();
+      tmpEnv->open(tmpFilename);
+      tmpEnv->setMapSize(std::max(kCacheFileMapSize, usedSize));
+      LMDB tmpDb(tmpEnv.get(), "cache");
+      {
+         BinaryWriter bwKey;
+         bwKey.put_uint8_t(DB_PREFIX);
+         CharacterArrayRef keyRef(bwKey.getSize(), bwKey.getData().getPtr());
+
+         LMDBEnv::Transaction tx(dbEnv_.get(), LMDB::ReadOnly);
+         auto dbIter = db_->begin();
+         dbIter.seek(keyRef, LMDB::Iterator::Seek_GE);
+         while (dbIter.isValid() && !stopped_) {
+            LMDBEnv::Transaction tmpTx(tmpEnv.get(), LMDB::ReadWrite);
+            for (size_t i = 0; (i < 1000) && dbIter.isValid(); ++i, dbIter.advance()) {
+               const auto key = dbIter.key();
+               const auto value = dbIter.value();
+               tmpDb.insert(CharacterArrayRef(key.mv_size, static_cast<const char *>(key.mv_data))
+                  , CharacterArrayRef(value.mv_size, static_cast<const char *>(value.mv_data)));
+            }
+         }
       }
+      tmpDb.close();
+      tmpEnv->close();
+   } catch (const std::exception &) {
+      SystemFileUtils::rmFile(tmpFilename);
+      SystemFileUtils::rmFile(tmpFilename + "-lock");
+      return;
+   }
+   if (stopped_) {   // copy is incomplete
+      SystemFileUtils::rmFile(tmpFilename);
+      SystemFileUtils::rmFile(tmpFilename + "-lock");
+      return;
+   }
 
-      start = curTime;
+   // Readers wait for the file to be replaced, new entries stay in memory meanwhile
+   std::unique_lock<std::shared_mutex> lock(dbMutex_);
+   db_->close();
+   dbEnv_->close();
+   delete db_;
+   db_ = nullptr;
 
+   SystemFileUtils::rmFile(filename_);
+   if (std::rename(tmpFilename.c_str(), filename_.c_str()) != 0) {
+      SystemFileUtils::rmFile(tmpFilename);
+      diskElems_ = 0;   // starting with empty file
+      diskBytes_ = 0;
+   }
+   SystemFileUtils::rmFile(tmpFilename + "-lock");
+   openDb();
+}
+
+void CacheFile::saver()
+{
+   size_t nbElems = 0;
+   size_t nbBytes = 0;
+   scan(nbElems, nbBytes);
+   if ((compactRatio_ > 0) && !stopped_) {
+      compact(nbElems, nbBytes);
+   }
+   while (!stopped_) {
+      {
+         std::unique_lock<std::mutex> lock(cvMutex_);
+         cvSave_.wait_for(lock, flushInterval_, [this] {
+            return stopped_ || (queueDepth_ >= flushBatchSize_);
+         });
+      }
+      if (stopped_) {
+         break;
+      }
+      purge();
       write();
+      purgeDisk();
    }
    write();    // final flush
 }
 
 void CacheFile::purge()
-{  // simple purge - without LRU/MRU counters
-   {
-      std::unique_lock<std::mutex> lock(rwMutex_);
-      if (map_.size() < nbMaxElems_) {
-         return;
+{
+   std::vector<BinaryData> evicted;
+   for (const auto &shard : shards_) {
+      std::unique_lock<std::shared_mutex> lock(shard->mutex);
+      BinaryData key;
+      while (!stopped_ && shard->overLimit() && shard->evictOne(key)) {
+         // Evicted entry is already saved. In lazy mode it stays in the file and could be read again.
+         if (!lazyLoad_) {
+            evicted.push_back(std::move(key));
+         }
+      }
+   }
+   if (evicted.empty()) {
+      return;
+   }
+
+   LMDBEnv::Transaction tx(dbEnv_.get(), LMDB::ReadWrite);
+   try {
+      for (const auto &key : evicted) {
+         BinaryWriter bwKey;
+         bwKey.put_uint8_t(DB_PREFIX);
+         bwKey.put_BinaryData(key);
+
+         CharacterArrayRef keyRef(bwKey.getData().getSize(), bwKey.getData().getPtr());
+         db_->erase(keyRef);
       }
+      tx.commit();
+   } catch (const std::exception &) {
+      tx.rollback();    // evicted entries will be loaded again on next start only
    }
-   std::unique_lock<std::mutex> lock(rwMutex_);
+}
+
+void CacheFile::purgeDisk()
+{
+   const auto overLimit = [this](size_t nbElems, size_t nbBytes) {
+      return (nbElems > diskMaxElems_) || (diskMaxBytes_ && (nbBytes > diskMaxBytes_));
+   };
+   if (!lazyLoad_ || !overLimit(diskElems_, diskBytes_)) {
+      return;
+   }
+   const auto isCached = [this](const BinaryData &key) {
+      const auto &shard = shardOf(key);
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      return (shard.map.find(key) != shard.map.end());
+   };
+
+   // Keys are hashes, so sweeping in key order evicts random entries. Ones kept in memory
+   // are skipped as recently used, and each entry is visited once at most.
+   std::vector<BinaryData> evicted;
+   size_t nbElems = diskElems_;
+   size_t nbBytes = diskBytes_;
    LMDBEnv::Transaction tx(dbEnv_.get(), LMDB::ReadWrite);
-   while (!stopped_ && (map_.size() >= nbMaxElems_)) {
-      const auto entry = map_.begin();
-      BinaryWriter bwKey;
-      bwKey.put_uint8_t(DB_PREFIX);
-      bwKey.put_BinaryData(entry->first);
+   try {
+      {
+         auto dbIter = db_->begin();
+         BinaryWriter bwKey;
+         bwKey.put_uint8_t(DB_PREFIX);
+         bwKey.put_BinaryData(diskCursor_);
+         dbIter.seek(CharacterArrayRef(bwKey.getSize(), bwKey.getData().getPtr()), LMDB::Iterator::Seek_GE);
 
-      CharacterArrayRef keyRef(bwKey.getData().getSize(), bwKey.getData().getPtr());
-      db_->erase(keyRef);
-      map_.erase(entry->first);
+         bool wrapped = false;
+         size_t nbVisited = 0;
+         while ((nbVisited < diskElems_) && overLimit(nbElems, nbBytes)) {
+            const bool valid = dbIter.isValid() && (dbIter.key().mv_size >= 2)
+               && (*static_cast<const uint8_t *>(dbIter.key().mv_data) == DB_PREFIX);
+            if (!valid) {
+               if (wrapped) {
+                  break;
+               }
+               wrapped = true;
+               BinaryWriter bwPrefix;
+               bwPrefix.put_uint8_t(DB_PREFIX);
+               dbIter.seek(CharacterArrayRef(bwPrefix.getSize(), bwPrefix.getData().getPtr())
+                  , LMDB::Iterator::Seek_GE);
+               continue;
+            }
+            ++nbVisited;
+            const auto iterkey = dbIter.key();
+            BinaryData key(static_cast<const uint8_t *>(iterkey.mv_data) + 1, iterkey.mv_size - 1);
+            const auto size = iterkey.mv_size + dbIter.value().mv_size;
+            dbIter.advance();
+            if (isCached(key)) {
+               continue;
+            }
+            --nbElems;
+            nbBytes -= size;
+            evicted.push_back(std::move(key));
+         }
+         if (dbIter.isValid() && (dbIter.key().mv_size >= 2)) {
+            const auto iterkey = dbIter.key();
+            diskCursor_ = BinaryData(static_cast<const uint8_t *>(iterkey.mv_data) + 1, iterkey.mv_size - 1);
+         } else {
+            diskCursor_ = {};
+         }
+      }
+
+      for (const auto &key : evicted) {
+         BinaryWriter bwKey;
+         bwKey.put_uint8_t(DB_PREFIX);
+         bwKey.put_BinaryData(key);
+         db_->erase(CharacterArrayRef(bwKey.getData().getSize(), bwKey.getData().getPtr()));
+      }
+      tx.commit();
+   } catch (const std::exception &) {
+      tx.rollback();    // retried after next flush
+      return;
    }
+   diskElems_ = nbElems;
+   diskBytes_ = nbBytes;
+   diskEvictions_ += evicted.size();
 }
 
-BinaryData CacheFile::get(const BinaryData &key) const
+std::shared_ptr<const BinaryData> CacheFile::get(const BinaryData &key)
 {
-   std::unique_lock<std::mutex> lock(rwMutex_);
-   auto it = map_.find(key);
-   if (it == map_.end()) {
-      if (inMem_) {
-         return {};
+   return getEntry(key).value;
+}
+
+CacheFile::CachedEntry CacheFile::getEntry(const BinaryData &key)
+{
+   auto &shard = shardOf(key);
+   if (rejectedByBloom(key)) {
+      ++shard.misses;
+      return {};
+   }
+   CachedEntry result;
+   {
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      if (shard.find(key, result)) {
+         ++shard.hits;
+         return result;
       }
-      else {
-         std::unique_lock<std::mutex> lockModif(cvMutex_);
-         it = mapModified_.find(key);
-         if (it == mapModified_.end()) {
-            return {};
+   }
+
+   if (lazyLoad_) {  // disk is read without locks, only the result is added under lock
+      result.value = readFromDb({ key }).front();
+      if (result.value) {
+         ++shard.hits;
+         ++shard.diskReads;
+         std::unique_lock<std::shared_mutex> lock(shard.mutex);
+         shard.insert(key, result.value);
+         return result;
+      }
+   }
+   ++shard.misses;
+   return {};
+}
+
+std::vector<CacheFile::CachedEntry> CacheFile::getEntries(const std::vector<BinaryData> &keys)
+{
+   std::vector<CachedEntry> result(keys.size());
+   std::vector<std::vector<size_t>> byShard(shards_.size());
+   for (size_t i = 0; i < keys.size(); ++i) {
+      const auto s = shardIndex(keys[i]);
+      if (rejectedByBloom(keys[i])) {
+         ++shards_[s]->misses;
+         continue;
+      }
+      byShard[s].push_back(i);
+   }
+
+   std::vector<BinaryData> missedKeys;
+   std::vector<size_t> missed;
+   for (size_t s = 0; s < shards_.size(); ++s) {
+      if (byShard[s].empty()) {
+         continue;
+      }
+      auto &shard = *shards_[s];
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      for (const auto i : byShard[s]) {
+         if (shard.find(keys[i], result[i])) {
+            ++shard.hits;
+         } else {
+            missedKeys.push_back(keys[i]);
+            missed.push_back(i);
          }
-         return it->second;
       }
    }
-   return it->second;
+   if (missed.empty()) {
+      return result;
+   }
+
+   std::vector<std::vector<size_t>> loadedByShard(shards_.size());
+   if (lazyLoad_) {  // all misses are read in single transaction
+      const auto values = readFromDb(missedKeys);
+      for (size_t m = 0; m < missed.size(); ++m) {
+         result[missed[m]].value = values[m];
+      }
+   }
+   for (const auto i : missed) {
+      const auto s = shardIndex(keys[i]);
+      auto &shard = *shards_[s];
+      if (result[i].value) {
+         ++shard.hits;
+         ++shard.diskReads;
+         loadedByShard[s].push_back(i);
+      } else {
+         ++shard.misses;
+      }
+   }
+   for (size_t s = 0; s < shards_.size(); ++s) {
+      if (loadedByShard[s].empty()) {
+         continue;
+      }
+      auto &shard = *shards_[s];
+      std::unique_lock<std::shared_mutex> lock(shard.mutex);
+      for (const auto i : loadedByShard[s]) {
+         shard.insert(keys[i], result[i].value);
+      }
+   }
+   return result;
+}
+
+std::map<BinaryData, std::shared_ptr<const BinaryData>> CacheFile::getBatch(const std::vector<BinaryData> &keys
+   , std::vector<BinaryData> &misses)
+{
+   std::map<BinaryData, std::shared_ptr<const BinaryData>> result;
+   const auto entries = getEntries(keys);
+   for (size_t i = 0; i < keys.size(); ++i) {
+      if (entries[i].value) {
+         result[keys[i]] = entries[i].value;
+      } else {
+         misses.push_back(keys[i]);
+      }
+   }
+   return result;
+}
+
+std::vector<std::shared_ptr<const BinaryData>> CacheFile::readFromDb(const std::vector<BinaryData> &keys)
+{
+   std::vector<std::shared_ptr<const BinaryData>> result(keys.size());
+   std::shared_lock<std::shared_mutex> lock(dbMutex_);
+   LMDBEnv::Transaction tx(dbEnv_.get(), LMDB::ReadOnly);
+   for (size_t i = 0; i < keys.size(); ++i) {
+      BinaryWriter bwKey;
+      bwKey.put_uint8_t(DB_PREFIX);
+      bwKey.put_BinaryData(keys[i]);
+      CharacterArrayRef keyRef(bwKey.getData().getSize(), bwKey.getData().getPtr());
+
+      const auto dataRef = db_->get_NoCopy(keyRef);
+      if (dataRef.data && dataRef.len) {
+         result[i] = std::make_shared<const BinaryData>(reinterpret_cast<const uint8_t*>(dataRef.data), dataRef.len);
+      }
+   }
+   return result;
 }
 
 void CacheFile::put(const BinaryData &key, const BinaryData &val)
 {
+   putEntry(key, std::make_shared<const BinaryData>(val));
+}
+
+void CacheFile::put(const BinaryData &key, const std::shared_ptr<const BinaryData> &val)
+{
+   putEntry(key, val);
+}
+
+void CacheFile::putBatch(const std::map<BinaryData, std::shared_ptr<const BinaryData>> &values)
+{
+   std::vector<std::pair<BinaryData, CachedEntry>> entries;
+   entries.reserve(values.size());
+   for (const auto &value : values) {
+      entries.push_back({ value.first, { value.second, nullptr } });
+   }
+   putEntries(entries);
+}
+
+bool CacheFile::putLocked(Shard &shard, const BinaryData &key, const CachedEntry &entry)
+{
+   if (bloom_) {
+      bloom_->add(key);
+   }
+   shard.insert(key, entry.value, entry.object, entry.objectSize);
    if (inMem_) {
-      std::unique_lock<std::mutex> lock(rwMutex_);
-      map_[key] = val;
+      // No saver thread in memory-only mode - evict inline to keep the same limits
+      BinaryData evictedKey;
+      while (shard.overLimit() && shard.evictOne(evictedKey)) {}
+      return false;
    }
-   else {
-      std::unique_lock<std::mutex> lock(cvMutex_);
-      mapModified_[key] = val;
+   return shard.modified.insert_or_assign(key, entry.value).second
+      && (++queueDepth_ == flushBatchSize_);
+}
+
+void CacheFile::putEntry(const BinaryData &key, const std::shared_ptr<const BinaryData> &val
+   , const std::shared_ptr<const void> &object, size_t objectSize)
+{
+   if (!val) {
+      return;
+   }
+   auto &shard = shardOf(key);
+   bool flushNow = false;
+   {
+      std::unique_lock<std::shared_mutex> lock(shard.mutex);
+      flushNow = putLocked(shard, key, { val, object, objectSize });
+   }
+   if (flushNow) {
+      cvSave_.notify_one();
    }
 }
 
+void CacheFile::putEntries(const std::vector<std::pair<BinaryData, CachedEntry>> &entries)
+{
+   std::vector<std::vector<size_t>> byShard(shards_.size());
+   for (size_t i = 0; i < entries.size(); ++i) {
+      if (entries[i].second.value) {
+         byShard[shardIndex(entries[i].first)].push_back(i);
+      }
+   }
+
+   bool flushNow = false;
+   for (size_t s = 0; s < shards_.size(); ++s) {
+      if (byShard[s].empty()) {
+         continue;
+      }
+      auto &shard = *shards_[s];
+      std::unique_lock<std::shared_mutex> lock(shard.mutex);
+      for (const auto i : byShard[s]) {
+         flushNow |= putLocked(shard, entries[i].first, entries[i].second);
+      }
+   }
+   if (flushNow) {
+      cvSave_.notify_one();
+   }
+}
+
+void CacheFile::attachObject(const BinaryData &key, const std::shared_ptr<const BinaryData> &val
+   , const std::shared_ptr<const void> &object, size_t objectSize)
+{
+   auto &shard = shardOf(key);
+   std::unique_lock<std::shared_mutex> lock(shard.mutex);
+   const auto it = shard.map.find(key);
+   if ((it == shard.map.end()) || (it->second.value != val) || it->second.object) {
+      return;
+   }
+   shard.nbBytes += objectSize;
+   it->second.object = object;
+   it->second.objectSize = objectSize;
+}
+
+CacheFileStats CacheFile::stats() const
+{
+   CacheFileStats result;
+   for (const auto &shard : shards_) {
+      std::shared_lock<std::shared_mutex> lock(shard->mutex);
+      result.hits += shard->hits;
+      result.misses += shard->misses;
+      result.diskReads += shard->diskReads;
+      result.evictions += shard->evictions;
+      result.nbElems += shard->map.size();
+      result.nbBytes += shard->nbBytes;
+   }
+   result.queueDepth = queueDepth_;
+   result.flushes = flushes_;
+   result.flushDurationMs = flushDurationMs_;
+   result.maxFlushDurationMs = maxFlushDurationMs_;
+   result.mapSize = mapSize_;
+   result.mapResizes = mapResizes_;
+   result.writeErrors = writeErrors_;
+   result.bloomRejects = bloomRejects_;
+   result.diskElems = diskElems_;
+   result.diskBytes = diskBytes_;
+   result.diskEvictions = diskEvictions_;
+   return result;
+}
+
 void TxCacheFile::put(const BinaryData &key, const std::shared_ptr<const Tx> &tx)
 {
-   std::lock_guard<std::mutex> lock(txMapMutex_);
-   txMap_[key] = tx;
    if (!tx || !tx->isInitialized()) {
       return;
    }
-   CacheFile::put(key, tx->serialize());
+   auto data = std::make_shared<const BinaryData>(tx->serialize());
+   const auto objectSize = sizeof(Tx) + data->getSize();
+   putEntry(key, data, tx, objectSize);
+   clearUnknown(key);
+}
+
+void TxCacheFile::putBatch(const std::map<BinaryData, std::shared_ptr<const Tx>> &txs)
+{
+   std::vector<std::pair<BinaryData, CachedEntry>> entries;
+   entries.reserve(txs.size());
+   for (const auto &tx : txs) {
+      if (!tx.second || !tx.second->isInitialized()) {
+         continue;
+      }
+      auto data = std::make_shared<const BinaryData>(tx.second->serialize());
+      const auto objectSize = sizeof(Tx) + data->getSize();
+      entries.push_back({ tx.first, { std::move(data), tx.second, objectSize } });
+   }
+   putEntries(entries);
+   for (const auto &entry : entries) {
+      clearUnknown(entry.first);
+   }
 }
 
 std::shared_ptr<const Tx> TxCacheFile::get(const BinaryData &key)
 {
-   std::lock_guard<std::mutex> lock(txMapMutex_);
-   const auto &itTx = txMap_.find(key);
-   if (itTx != txMap_.end()) {
-      return itTx->second;
+   return parse(key, getEntry(key));
+}
+
+std::map<BinaryData, std::shared_ptr<const Tx>> TxCacheFile::getBatch(const std::vector<BinaryData> &keys
+   , std::vector<BinaryData> &misses)
+{
+   std::map<BinaryData, std::shared_ptr<const Tx>> result;
+   const auto entries = getEntries(keys);
+   for (size_t i = 0; i < keys.size(); ++i) {
+      auto tx = parse(keys[i], entries[i]);
+      if (tx) {
+         result[keys[i]] = std::move(tx);
+      } else {
+         misses.push_back(keys[i]);
+      }
+   }
+   return result;
+}
+
+std::shared_ptr<const Tx> TxCacheFile::parse(const BinaryData &key, const CachedEntry &entry)
+{
+   if (entry.object) {
+      return std::static_pointer_cast<const Tx>(entry.object);
    }
-   const auto &data = CacheFile::get(key);
-   if (data.empty()) {
+   if (!entry.value) {
       return nullptr;
    }
-   const auto tx = std::make_shared<Tx>(data);
-   txMap_[key] = tx;
+   // Parsed once, following hits share the same object
+   const auto tx = std::make_shared<const Tx>(*entry.value);
+   attachObject(key, entry.value, tx, sizeof(Tx) + entry.value->getSize());
    return tx;
 }
+
+void TxCacheFile::putUnknown(const BinaryData &key)
+{
+   const auto now = std::chrono::steady_clock::now();
+   std::lock_guard<std::mutex> lock(unknownMutex_);
+   if (unknown_.size() >= kMaxUnknownTxs) {
+      for (auto it = unknown_.begin(); it != unknown_.end(); ) {
+         if (it->second <= now) {
+            it = unknown_.erase(it);
+         } else {
+            ++it;
+         }
+      }
+      if (unknown_.size() >= kMaxUnknownTxs) {
+         return;
+      }
+   }
+   unknown_[key] = now + kUnknownTxTimeout;
+   nbUnknown_ = unknown_.size();
+}
+
+bool TxCacheFile::isUnknown(const BinaryData &key)
+{
+   if (!nbUnknown_) {
+      return false;
+   }
+   std::lock_guard<std::mutex> lock(unknownMutex_);
+   const auto it = unknown_.find(key);
+   if (it == unknown_.end()) {
+      return false;
+   }
+   if (it->second <= std::chrono::steady_clock::now()) {
+      unknown_.erase(it);
+      nbUnknown_ = unknown_.size();
+      return false;
+   }
+   return true;
+}
+
+void TxCacheFile::clearUnknown(const BinaryData &key)
+{
+   if (!nbUnknown_) {
+      return;
+   }
+   std::lock_guard<std::mutex> lock(unknownMutex_);
+   unknown_.erase(key);
+   nbUnknown_ = unknown_.size();
+}
+
+void TxCacheFile::clearUnknown()
+{
+   if (!nbUnknown_) {
+      return;
+   }
+   std::lock_guard<std::mutex> lock(unknownMutex_);
+   unknown_.clear();
+   nbUnknown_ = 0;
+}
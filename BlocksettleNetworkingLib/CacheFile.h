@@ -13,57 +13,213 @@
 
 #include <unordered_map>
 #include <atomic>
+#include <map>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
 #include <thread>
 #include <lmdbpp.h>
-#include "AsyncClient.h"
 #include "BinaryData.h"
 #include "TxClasses.h"
 
 
+// LMDB fsync policy: NoMetaSync could lose the last committed transaction on system crash,
+// NoSync could lose more of them (file stays consistent on journaling FS only)
+enum class CacheFileSync
+{
+   Full,
+   NoMetaSync,
+   NoSync
+};
+
+struct CacheFileParams
+{
+   size_t   nbElemLimit{ 10000 };
+   size_t   byteLimit{ 0 };
+   // Don't preload the whole file - entries missing in memory are read from LMDB on demand,
+   // limits above are applied to entries kept in memory only
+   bool     lazyLoad{ false };
+   // Lazy mode only: entries evicted from memory stay in the file until it exceeds these limits
+   // (0 - the same as nbElemLimit and byteLimit), then they are erased in key order
+   size_t   diskElemLimit{ 0 };
+   size_t   diskByteLimit{ 0 };
+   // Keys are spread between shards with separate locks, limits are split evenly between them
+   size_t   nbShards{ 16 };
+   // Modified entries are committed not later than flushInterval or as soon as flushBatchSize
+   // of them are queued, single LMDB transaction is limited to flushBatchSize entries
+   std::chrono::milliseconds  flushInterval{ 1000 };
+   size_t   flushBatchSize{ 1000 };
+   CacheFileSync  syncMode{ CacheFileSync::Full };
+   // LMDB map is doubled on MDB_MAP_FULL up to this size, entries not fitting stay in memory only
+   size_t   maxMapSize{ size_t(2048) * 1024 * 1024 };
+   // File is compacted in background after open if live data is estimated to take less than
+   // this part of it (0 to disable)
+   double   compactRatio{ 0.5 };
+   // Keys are added to bloom filter, so most misses are detected without locks and disk reads.
+   // Existing keys are added in background on open, misses are not filtered until it's finished.
+   bool     bloomFilter{ true };
+};
+
+struct CacheFileStats
+{
+   uint64_t hits{};
+   uint64_t misses{};
+   uint64_t diskReads{};   // hits loaded from LMDB in lazy mode
+   uint64_t evictions{};
+   size_t   nbElems{};
+   size_t   nbBytes{};     // keys, values and attached objects size
+   size_t   diskElems{};   // entries in LMDB (lazy mode only)
+   size_t   diskBytes{};
+   uint64_t diskEvictions{};
+   size_t   queueDepth{};  // modified entries not yet committed to LMDB
+   uint64_t flushes{};
+   uint64_t flushDurationMs{};      // total for all flushes
+   uint64_t maxFlushDurationMs{};
+   size_t   mapSize{};
+   uint64_t mapResizes{};
+   uint64_t writeErrors{};    // entries not saved to LMDB
+   uint64_t bloomRejects{};   // misses detected by bloom filter
+};
+
+// Entries not accessed recently are evicted (CLOCK) when nbElemLimit or byteLimit (if not 0) is reached.
+// Values are immutable and shared, so a hit doesn't copy data.
 class CacheFile
 {
 public:
-   CacheFile(const std::string &filename, size_t nbElemLimit = 10000);
+   CacheFile(const std::string &filename, size_t nbElemLimit = 10000, size_t byteLimit = 0);
+   CacheFile(const std::string &filename, const CacheFileParams &);
    ~CacheFile();
 
    void put(const BinaryData &key, const BinaryData &val);
-   BinaryData get(const BinaryData &key) const;
+   void put(const BinaryData &key, const std::shared_ptr<const BinaryData> &val);
+   // Returns nullptr if not found
+   std::shared_ptr<const BinaryData> get(const BinaryData &key);
+   // Batch versions lock each shard once, keys not found are added to misses
+   std::map<BinaryData, std::shared_ptr<const BinaryData>> getBatch(const std::vector<BinaryData> &keys
+      , std::vector<BinaryData> &misses);
+   void putBatch(const std::map<BinaryData, std::shared_ptr<const BinaryData>> &);
    void stop();
 
+   CacheFileStats stats() const;
+
 protected:
+   // Parsed form of the value could be kept in the same entry (sharing eviction and byte budget)
+   struct CachedEntry
+   {
+      std::shared_ptr<const BinaryData>   value;
+      std::shared_ptr<const void>         object;
+      size_t   objectSize{ 0 };
+   };
+   CachedEntry getEntry(const BinaryData &key);
+   // Result has the same order as keys, misses have empty value
+   std::vector<CachedEntry> getEntries(const std::vector<BinaryData> &keys);
+   void putEntry(const BinaryData &key, const std::shared_ptr<const BinaryData> &val
+      , const std::shared_ptr<const void> &object = nullptr, size_t objectSize = 0);
+   void putEntries(const std::vector<std::pair<BinaryData, CachedEntry>> &);
+   // Attaches object to existing entry if its value is still the same
+   void attachObject(const BinaryData &key, const std::shared_ptr<const BinaryData> &val
+      , const std::shared_ptr<const void> &object, size_t objectSize);
+
    void read();
    void write();
    void saver();
    void purge();
+   // Erases entries from LMDB while it's over disk limits (lazy mode)
+   void purgeDisk();
+
+private:
+   struct Shard;
+   struct BloomFilter;
+
+   size_t shardIndex(const BinaryData &key) const;
+   Shard &shardOf(const BinaryData &key) const;
+   // Should be called with shard exclusively locked, returns true if flush is needed
+   bool putLocked(Shard &, const BinaryData &key, const CachedEntry &);
+   std::vector<std::shared_ptr<const BinaryData>> readFromDb(const std::vector<BinaryData> &keys);
+   bool writeBatch(const std::vector<std::pair<BinaryData, std::shared_ptr<const BinaryData>>> &
+      , size_t begin, size_t end, bool &mapFull);
+   bool growMap();
+   // Counts entries in LMDB and fills bloom filter in background
+   void scan(size_t &nbElems, size_t &nbBytes);
+   // Returns true if key is definitely not in cache
+   bool rejectedByBloom(const BinaryData &key);
+   void compact(size_t nbElems, size_t nbBytes);
+   void openDb();
 
 private:
+   const std::string filename_;
    const bool  inMem_;
+   const bool  lazyLoad_;
    size_t      nbMaxElems_;
+   size_t      maxBytes_;
+   const size_t   diskMaxElems_;
+   const size_t   diskMaxBytes_;
+   const std::chrono::milliseconds  flushInterval_;
+   const size_t   flushBatchSize_;
+   const size_t   maxMapSize_;
+   const double   compactRatio_;
+   unsigned int   envFlags_{ 0 };
+   std::atomic<size_t>  mapSize_{ 0 };
    LMDB     *  db_ = nullptr;
    std::shared_ptr<LMDBEnv>  dbEnv_;
-   std::map<BinaryData, BinaryData> map_, mapModified_;
+   // Shared by readers' transactions, exclusive for map resize and file replacement after compaction
+   // (no transaction could be active then)
+   mutable std::shared_mutex  dbMutex_;
+   std::vector<std::unique_ptr<Shard>> shards_;
+   std::unique_ptr<BloomFilter>  bloom_;
+   std::atomic_bool           bloomReady_{ false };
    std::thread thread_;
    std::condition_variable    cvSave_;
    mutable std::mutex         cvMutex_;
-   mutable std::mutex         rwMutex_;
    std::atomic_bool           stopped_{ false };
+   std::atomic<size_t>        queueDepth_{ 0 };
+   std::atomic<uint64_t>      flushes_{ 0 };
+   std::atomic<uint64_t>      flushDurationMs_{ 0 };
+   std::atomic<uint64_t>      maxFlushDurationMs_{ 0 };
+   std::atomic<uint64_t>      mapResizes_{ 0 };
+   std::atomic<uint64_t>      writeErrors_{ 0 };
+   std::atomic<uint64_t>      bloomRejects_{ 0 };
+   // LMDB contents in lazy mode, updated by saver thread only
+   std::atomic<size_t>        diskElems_{ 0 };
+   std::atomic<size_t>        diskBytes_{ 0 };
+   std::atomic<uint64_t>      diskEvictions_{ 0 };
+   BinaryData                 diskCursor_;   // next disk eviction sweep starts from this key
 };
 
 
 class TxCacheFile : protected CacheFile
 {
 public:
-   TxCacheFile(const std::string &filename, size_t nbElemLimit = 10000)
-      : CacheFile(filename, nbElemLimit) {}
+   TxCacheFile(const std::string &filename, size_t nbElemLimit = 10000, size_t byteLimit = 0)
+      : CacheFile(filename, nbElemLimit, byteLimit) {}
+   TxCacheFile(const std::string &filename, const CacheFileParams &params)
+      : CacheFile(filename, params) {}
 
    void put(const BinaryData &key, const std::shared_ptr<const Tx> &tx);
    std::shared_ptr<const Tx> get(const BinaryData &key);
+   std::map<BinaryData, std::shared_ptr<const Tx>> getBatch(const std::vector<BinaryData> &keys
+      , std::vector<BinaryData> &misses);
+   void putBatch(const std::map<BinaryData, std::shared_ptr<const Tx>> &);
+
+   // Hashes reported unknown by the server are remembered for a short time
+   void putUnknown(const BinaryData &key);
+   bool isUnknown(const BinaryData &key);
+   void clearUnknown(const BinaryData &key);
+   void clearUnknown();
 
    void stop() { CacheFile::stop(); }
+   CacheFileStats stats() const { return CacheFile::stats(); }
+
+private:
+   std::shared_ptr<const Tx> parse(const BinaryData &key, const CachedEntry &);
 
 private:
-   AsyncClient::TxBatchResult txMap_;
-   std::mutex txMapMutex_;
+   std::map<BinaryData, std::chrono::steady_clock::time_point> unknown_;
+   std::mutex           unknownMutex_;
+   std::atomic<size_t>  nbUnknown_{ 0 };
 };
 
 #endif // __CACHE_FILE_H__
@@ -24,6 +24,13 @@ void DataConnection::notifyOnData(const std::string& data)
    }
 }
 
+void DataConnection::notifyOnData(std::string&& data)
+{
+   if (listener_) {
+      listener_->OnDataReceivedOwned(std::move(data));
+   }
+}
+
 void DataConnection::notifyOnConnected()
 {
    if (listener_) {
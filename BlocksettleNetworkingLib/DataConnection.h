@@ -61,6 +61,7 @@ protected:
    virtual void onRawDataReceived(const std::string& rawData) {}
 
    void notifyOnData(const std::string& data);
+   void notifyOnData(std::string&& data);
    virtual void notifyOnConnected();
    void notifyOnDisconnected();
    void notifyOnError(DataConnectionListener::DataConnectionError errorCode);
@@ -42,6 +42,10 @@ public:
 
 public:
    virtual void OnDataReceived(const std::string& data) = 0;
+   // Called by connections which could give away the received buffer.
+   // Override to take ownership of the data without copying it. Has its own name,
+   // so overriding OnDataReceived alone doesn't hide it.
+   virtual void OnDataReceivedOwned(std::string&& data) { OnDataReceived(data); }
    virtual void OnConnected() = 0;
    virtual void OnDisconnected() = 0;
    virtual void OnError(DataConnectionError errorCode) = 0;
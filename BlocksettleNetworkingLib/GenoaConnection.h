@@ -42,8 +42,15 @@ public:
 public:
    bool send(const std::string& data) override
    {
-      std::string message = data + marker;
-      return _S::sendRawData(message);
+      std::string message;
+      frameData(data, message);
+      return _S::sendRawData(std::move(message));
+   }
+
+   bool frameData(const std::string& data, std::string& rawData) const override
+   {
+      rawData = data + marker;
+      return true;
    }
 
 protected:
@@ -14,217 +14,913 @@
 #else // WIN32
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
 #endif
-#include <unordered_set>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <deque>
 #include <openssl/err.h>
 #include <spdlog/spdlog.h>
 #include "BinaryData.h"
 
-class SSLDisconnectedException : public std::runtime_error
-{
-public:
-   SSLDisconnectedException(const std::string& what = {}) : std::runtime_error(what) {}
-};
+namespace {
 
-HttpsConnection::HttpsConnection(const std::shared_ptr<spdlog::logger> &logger
-   , const std::string &host)
-   : logger_(logger), host_(host)
+   const size_t kMaxConnections = 4;
+   const int kPollTimeoutMs = 5;
+   const auto kIdleTimeout = std::chrono::seconds(30);
+   // For TCP connect with TLS handshake, and for queued requests not written to the socket
+   const auto kConnectTimeout = std::chrono::seconds(10);
+   const auto kWriteTimeout = std::chrono::seconds(10);
+
+#ifdef WIN32
+   using SocketType = SOCKET;
+   const SocketType kInvalidSocket = INVALID_SOCKET;
+#else
+   using SocketType = int;
+   const SocketType kInvalidSocket = -1;
+#endif
+
+   void closeSocket(SocketType s)
+   {
+#ifdef WIN32
+      closesocket(s);
+#else
+      close(s);
+#endif
+   }
+
+   bool setNonBlocking(SocketType s)
+   {
+#ifdef WIN32
+      u_long mode = 1;
+      return ioctlsocket(s, FIONBIO, &mode) == 0;
+#else
+      const int flags = fcntl(s, F_GETFL, 0);
+      return (flags >= 0) && (fcntl(s, F_SETFL, flags | O_NONBLOCK) == 0);
+#endif
+   }
+
+   bool connectInProgress()
+   {
+#ifdef WIN32
+      return (WSAGetLastError() == WSAEWOULDBLOCK);
+#else
+      return (errno == EINPROGRESS);
+#endif
+   }
+
+   int pollSockets(pollfd *fds, size_t count, int timeoutMs)
+   {
+#ifdef WIN32
+      return WSAPoll(fds, static_cast<ULONG>(count), timeoutMs);
+#else
+      return poll(fds, static_cast<nfds_t>(count), timeoutMs);
+#endif
+   }
+
+   std::string toLower(std::string str)
+   {
+      std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c) {
+         return static_cast<char>(std::tolower(c));
+      });
+      return str;
+   }
+
+   struct CompletedResponse
+   {
+      HttpsConnection::ResponseCb cb;
+      int status;
+      std::string body;
+   };
+
+} // namespace
+
+
+struct HttpsConnection::Connection
 {
-   connectSocket();
+   struct PendingRequest
+   {
+      uint64_t    id;
+      ResponseCb  cb;
+      std::string data;       // released when written, kept for retry until then
+      uint64_t    endPos;     // position of request end in the connection's output stream
+      unsigned    attempt;
+   };
+
+   // Connection is opened by event loop, requests are queued meanwhile
+   enum class Phase
+   {
+      Idle,
+      Connecting,
+      Handshaking,
+      Open,
+   };
+
+   enum class State
+   {
+      Headers,
+      Body,
+      BodyUntilClose,
+      ChunkSize,
+      ChunkData,
+      ChunkDataEnd,
+      Trailers,
+   };
+
+   // Guards ssl and all fields below. Socket operations are non-blocking, so it's held shortly.
+   std::mutex  mutex;
+   SocketType  sock{ kInvalidSocket };
+   SSL   *ssl{ nullptr };
+   Phase phase{ Phase::Idle };
+   bool  wantWrite{ false };  // SSL operation waits for the socket to become writable
+   bool  closed{ false };
+   bool  keepAlive{ true };
+   std::chrono::steady_clock::time_point lastActive{ std::chrono::steady_clock::now() };
+   std::chrono::steady_clock::time_point connectDeadline;
+
+   // Requests queued to the connection and not written yet, in the same order as pending
+   std::string out;
+   size_t      inWrite{ 0 };  // size of unfinished SSL_write, it's retried with the same data
+   uint64_t    queued{ 0 };
+   uint64_t    written{ 0 };
+
+   // HTTP/1.1 responses come in the same order as requests were sent
+   std::deque<PendingRequest> pending;
+
+   std::string buffer;
+   State       state{ State::Headers };
+   int         status{};
+   size_t      remaining{};
+   std::string body;
 
-   std::thread([this] {
-      while (!stopped_ && inRequest_) {
-         try {
-            const auto &data = readSocket();
-            process(data);
-            if (data.empty()) {
-               std::this_thread::sleep_for(std::chrono::milliseconds{ 5 });
+   // Raw data of responses without callback (legacy requests) goes to raw
+   void parse(std::vector<CompletedResponse> &completed, std::string &raw)
+   {
+      bool progress = true;
+      while (progress) {
+         progress = false;
+         switch (state) {
+         case State::Headers: {
+            const auto pos = buffer.find("\r\n\r\n");
+            if (pos == std::string::npos) {
+               break;
             }
+            parseHeaders(pos);
+            consume(pos + 4, raw);
+            if ((status >= 100) && (status < 200)) {
+               state = State::Headers;    // interim response, the final one follows
+            }
+            else if ((state == State::Body) && !remaining) {
+               finish(completed);
+            }
+            progress = true;
+            break;
          }
-         catch (const SSLDisconnectedException&) {
-            std::this_thread::sleep_for(std::chrono::milliseconds{ 50 });
+
+         case State::Body:
+         case State::ChunkData: {
+            const auto size = std::min(remaining, buffer.size());
+            if (!size) {
+               break;
+            }
+            takeBody(size, raw);
+            remaining -= size;
+            if (!remaining) {
+               if (state == State::Body) {
+                  finish(completed);
+               }
+               else {
+                  state = State::ChunkDataEnd;
+               }
+            }
+            progress = true;
+            break;
          }
-         catch (const std::exception &e) {
-            logger_->error("[HttpsConnection] {}", e.what());
-            std::this_thread::sleep_for(std::chrono::milliseconds{ 50 });
+
+         case State::BodyUntilClose:
+            takeBody(buffer.size(), raw);
+            break;
+
+         case State::ChunkSize: {
+            const auto pos = buffer.find("\r\n");
+            if (pos == std::string::npos) {
+               break;
+            }
+            remaining = std::strtoull(buffer.substr(0, pos).c_str(), nullptr, 16);
+            consume(pos + 2, raw);
+            state = remaining ? State::ChunkData : State::Trailers;
+            progress = true;
+            break;
+         }
+
+         case State::ChunkDataEnd:
+            if (buffer.size() < 2) {
+               break;
+            }
+            consume(2, raw);
+            state = State::ChunkSize;
+            progress = true;
+            break;
+
+         case State::Trailers: {
+            const auto pos = buffer.find("\r\n");
+            if (pos == std::string::npos) {
+               break;
+            }
+            consume(pos + 2, raw);
+            if (pos == 0) {
+               finish(completed);
+            }
+            progress = true;
+            break;
+         }
+         }
+      }
+   }
+
+   void release()
+   {
+      if (ssl) {
+         SSL_free(ssl);
+         ssl = nullptr;
+      }
+      if (sock != kInvalidSocket) {
+         closeSocket(sock);
+         sock = kInvalidSocket;
+      }
+   }
+
+   void finish(std::vector<CompletedResponse> &completed)
+   {
+      if (!pending.empty()) {
+         if (pending.front().cb) {
+            completed.push_back({ std::move(pending.front().cb), status, std::move(body) });
          }
+         pending.pop_front();
       }
-   }).detach();
+      body.clear();
+      state = State::Headers;
+   }
+
+private:
+   bool rawMode() const
+   {
+      return pending.empty() || !pending.front().cb;
+   }
+
+   void consume(size_t size, std::string &raw)
+   {
+      if (rawMode()) {
+         raw.append(buffer, 0, size);
+      }
+      buffer.erase(0, size);
+   }
+
+   void takeBody(size_t size, std::string &raw)
+   {
+      if (!rawMode()) {
+         body.append(buffer, 0, size);
+      }
+      consume(size, raw);
+   }
+
+   void parseHeaders(size_t size)
+   {
+      size_t lineStart = 0;
+      bool chunked = false;
+      bool hasLength = false;
+      bool statusLine = true;
+      remaining = 0;
+      status = 0;
+
+      while (lineStart < size) {
+         auto lineEnd = buffer.find("\r\n", lineStart);
+         if ((lineEnd == std::string::npos) || (lineEnd > size)) {
+            lineEnd = size;
+         }
+         const auto line = buffer.substr(lineStart, lineEnd - lineStart);
+         lineStart = lineEnd + 2;
+
+         if (statusLine) {
+            statusLine = false;
+            const auto pos = line.find(' ');
+            status = (pos == std::string::npos) ? -1 : std::atoi(line.c_str() + pos + 1);
+            if (line.compare(0, 8, "HTTP/1.0") == 0) {
+               keepAlive = false;
+            }
+            continue;
+         }
+         const auto pos = line.find(':');
+         if (pos == std::string::npos) {
+            continue;
+         }
+         const auto name = toLower(line.substr(0, pos));
+         auto value = line.substr(pos + 1);
+         value.erase(0, value.find_first_not_of(' '));
+
+         if (name == "content-length") {
+            remaining = std::strtoull(value.c_str(), nullptr, 10);
+            hasLength = true;
+         }
+         else if (name == "transfer-encoding") {
+            chunked = (toLower(value).find("chunked") != std::string::npos);
+         }
+         else if (name == "connection") {
+            keepAlive = (toLower(value).find("close") == std::string::npos);
+         }
+      }
+
+      if (chunked) {
+         state = State::ChunkSize;
+      }
+      else if (hasLength || (status == 204) || (status == 304)) {
+         state = State::Body;
+      }
+      else {
+         state = State::BodyUntilClose;
+         keepAlive = false;
+      }
+   }
+};
+
+
+HttpsConnection::HttpsConnection(const std::shared_ptr<spdlog::logger> &logger
+   , const std::string &host, uint16_t port)
+   : logger_(logger), host_(host), port_(port)
+{
+   const SSL_METHOD* meth = TLS_client_method();  //TLSv1_2_client_method();
+   ctx_ = SSL_CTX_new(meth);
+   if (!ctx_) {
+      throw std::runtime_error("error creating SSL context");
+   }
+   // Sessions (incl. TLS 1.3 tickets received after handshake) are kept by onNewSession
+   SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+   SSL_CTX_sess_set_new_cb(ctx_, onNewSession);
+   SSL_CTX_set_app_data(ctx_, this);
+
+   // The first connection is opened in advance by event loop
+   connections_.push_back(std::make_shared<Connection>());
+
+   eventThread_ = std::thread([this] {
+      eventLoop();
+   });
 }
 
 HttpsConnection::~HttpsConnection()
 {
    stopped_ = true;
-   disconnectSocket();
+   if (eventThread_.joinable()) {
+      eventThread_.join();
+   }
+
+   std::vector<std::shared_ptr<Connection>> connections;
+   {
+      std::lock_guard<std::mutex> lock(poolMutex_);
+      connections.swap(connections_);
+   }
+   for (const auto &conn : connections) {
+      std::lock_guard<std::mutex> lock(conn->mutex);
+      conn->closed = true;
+      conn->release();
+   }
+
+   if (session_) {
+      SSL_SESSION_free(session_);
+   }
+   SSL_CTX_free(ctx_);
 }
 
-void HttpsConnection::connectSocket()
+int HttpsConnection::onNewSession(SSL *ssl, SSL_SESSION *session)
 {
-#ifdef WIN32
-   SOCKET s;
-#else
-   int s;
-#endif
-   s = socket(AF_INET, SOCK_STREAM, 0);
-   if (s < 0) {
-      throw std::runtime_error("error creating SSL socket");
+   auto conn = static_cast<HttpsConnection *>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+   if (!conn) {
+      return 0;
    }
+   std::lock_guard<std::mutex> lock(conn->sessionMutex_);
+   if (conn->session_) {
+      SSL_SESSION_free(conn->session_);
+   }
+   conn->session_ = session;
+   return 1;   // we keep the reference
+}
 
-   struct hostent* he = nullptr;
-   he = gethostbyname(host_.c_str());
-   if (!he) {
-      throw std::runtime_error("host resolution error");
+// Called from event loop thread only. Blocking resolution delays other connections
+// of this instance, so the address is resolved once and kept until connect fails.
+bool HttpsConnection::resolveHost()
+{
+   if (hostAddr_) {
+      return true;
+   }
+   struct hostent* he = gethostbyname(host_.c_str());
+   if (!he || !he->h_addr_list[0]) {
+      logger_->error("[HttpsConnection] host resolution error for {}", host_);
+      return false;
    }
+   hostAddr_ = reinterpret_cast<const struct in_addr*>(he->h_addr_list[0])->s_addr;
+   return true;
+}
+
+// Should be called with conn.mutex locked
+bool HttpsConnection::startConnect(Connection &conn)
+{
+   conn.sock = socket(AF_INET, SOCK_STREAM, 0);
+   if (conn.sock == kInvalidSocket) {
+      logger_->error("[HttpsConnection] error creating SSL socket");
+      return false;
+   }
+   if (!setNonBlocking(conn.sock)) {
+      logger_->error("[HttpsConnection] error switching socket to non-blocking mode");
+      return false;
+   }
+   // Requests are written as a whole, don't hold their tail until previous segment is acked
+   const int noDelay = 1;
+   setsockopt(conn.sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+
    struct sockaddr_in sa;
    memset(&sa, 0, sizeof(sa));
    sa.sin_family = AF_INET;
-   sa.sin_addr.s_addr = inet_addr(inet_ntoa(*((struct in_addr*)he->h_addr_list[0])));
-   sa.sin_port = htons(443);
+   sa.sin_addr.s_addr = hostAddr_;
+   sa.sin_port = htons(port_);
+   if (connect(conn.sock, (struct sockaddr*)&sa, sizeof(sa)) && !connectInProgress()) {
+      logger_->error("[HttpsConnection] error connecting to {}", host_);
+      hostAddr_ = 0;
+      return false;
+   }
+   conn.phase = Connection::Phase::Connecting;
+   conn.connectDeadline = std::chrono::steady_clock::now() + kConnectTimeout;
+   return true;
+}
+
+// Called from event loop when the socket of connecting connection is ready
+bool HttpsConnection::continueConnect(const std::shared_ptr<Connection> &conn)
+{
+   std::lock_guard<std::mutex> lock(conn->mutex);
+   if (conn->closed) {
+      return true;
+   }
+   if (conn->phase == Connection::Phase::Connecting) {
+      int error = 0;
 #ifdef WIN32
-   int socklen = sizeof(sa);
+      int len = sizeof(error);
 #else
-   socklen_t socklen = sizeof(sa);
+      socklen_t len = sizeof(error);
 #endif
-   if (connect(s, (struct sockaddr*)&sa, socklen)) {
-      throw std::runtime_error("error connecting to server");
-   }
-   const SSL_METHOD* meth = TLS_client_method();  //TLSv1_2_client_method();
-   ctx_ = SSL_CTX_new(meth);
-   ssl_ = SSL_new(ctx_);
-   if (!ssl_) {
-      throw std::runtime_error("error creating SSL");
-   }
+      if (getsockopt(conn->sock, SOL_SOCKET, SO_ERROR, (char*)&error, &len) || error) {
+         logger_->error("[HttpsConnection] error {} connecting to {}", error, host_);
+         hostAddr_ = 0;
+         return false;
+      }
+
+      conn->ssl = SSL_new(ctx_);
+      if (!conn->ssl) {
+         logger_->error("[HttpsConnection] error creating SSL");
+         return false;
+      }
 #ifdef WIN32
-   SSL_set_fd(ssl_, (int)s);
+      SSL_set_fd(conn->ssl, (int)conn->sock);
 #else
-   SSL_set_fd(ssl_, s);
+      SSL_set_fd(conn->ssl, conn->sock);
 #endif
+      // Queued data is written in parts as the socket accepts it
+      SSL_set_mode(conn->ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+      SSL_set_tlsext_host_name(conn->ssl, host_.c_str());
+      {
+         std::lock_guard<std::mutex> sessionLock(sessionMutex_);
+         if (session_) {
+            SSL_set_session(conn->ssl, session_);
+         }
+      }
+      conn->phase = Connection::Phase::Handshaking;
+   }
 
-   SSL_set_mode(ssl_, SSL_MODE_AUTO_RETRY);
-   SSL_set_tlsext_host_name(ssl_, host_.c_str());
+   const int rc = SSL_connect(conn->ssl);
+   if (rc <= 0) {
+      const int err = SSL_get_error(conn->ssl, rc);
+      if ((err == SSL_ERROR_WANT_READ) || (err == SSL_ERROR_WANT_WRITE)) {
+         conn->wantWrite = (err == SSL_ERROR_WANT_WRITE);
+         return true;
+      }
+      logger_->error("[HttpsConnection] error {} creating HTTPS connection to {}", err, host_);
+      return false;
+   }
 
-   int err = SSL_connect(ssl_);
-   if (err <= 0) {
-      throw std::runtime_error("error " + std::to_string(SSL_get_error(ssl_, err)) + " creating HTTPS connection to " + host_);
+   conn->phase = Connection::Phase::Open;
+   conn->wantWrite = false;
+   conn->lastActive = std::chrono::steady_clock::now();
+   ++connectsCount_;
+   const bool resumed = SSL_session_reused(conn->ssl);
+   if (resumed) {
+      ++resumedCount_;
    }
-   logger_->info("[HttpsConnection] SSL to {} using {}", host_, SSL_get_cipher(ssl_));
+   logger_->info("[HttpsConnection] SSL to {} using {}{}", host_, SSL_get_cipher(conn->ssl)
+      , resumed ? " (resumed)" : "");
+   return flushOut(*conn);
 }
 
-void HttpsConnection::disconnectSocket()
+// Should be called with conn.mutex locked, returns false on write error
+bool HttpsConnection::flushOut(Connection &conn)
 {
-   if (ssl_) {
-      close(SSL_get_fd(ssl_));
-      SSL_free(ssl_);
+   while (!conn.out.empty()) {
+      const auto size = conn.inWrite ? conn.inWrite : std::min<size_t>(conn.out.size(), INT_MAX);
+      const int len = SSL_write(conn.ssl, conn.out.data(), static_cast<int>(size));
+      if (len <= 0) {
+         const int err = SSL_get_error(conn.ssl, len);
+         if ((err == SSL_ERROR_WANT_WRITE) || (err == SSL_ERROR_WANT_READ)) {
+            conn.inWrite = size;
+            conn.wantWrite = (err == SSL_ERROR_WANT_WRITE);
+            break;
+         }
+         logger_->warn("[HttpsConnection] SSL write error {}", err);
+         return false;
+      }
+      conn.inWrite = 0;
+      conn.wantWrite = false;
+      conn.out.erase(0, len);
+      conn.written += len;
+      conn.lastActive = std::chrono::steady_clock::now();
    }
-   ssl_ = nullptr;
 
-   if (ctx_) {
-      SSL_CTX_free(ctx_);
+   for (auto &request : conn.pending) {
+      if (request.endPos > conn.written) {
+         break;
+      }
+      std::string().swap(request.data);
    }
-   ctx_ = nullptr;
+   return true;
 }
 
-std::string HttpsConnection::readSocket()
+// Doesn't do any I/O: new connection is reserved in the pool right away and opened by event loop
+std::shared_ptr<HttpsConnection::Connection> HttpsConnection::getConnection()
 {
-   if (!ssl_) {
-      throw SSLDisconnectedException();
-   }
-   char buf[8 * 1024];
-   int len = 0;
-   len = SSL_read(ssl_, buf, sizeof(buf));
-   if (len <= 0) {
-      if (!ssl_) {
-         throw SSLDisconnectedException();
+   std::lock_guard<std::mutex> lock(poolMutex_);
+   std::shared_ptr<Connection> leastLoaded;
+   size_t leastPending = 0;
+   for (const auto &conn : connections_) {
+      std::lock_guard<std::mutex> connLock(conn->mutex);
+      if (conn->closed || !conn->keepAlive) {
+         continue;
       }
-      const int err = SSL_get_error(ssl_, len);
-      switch (err) {
-      case SSL_ERROR_WANT_READ:
-      case SSL_ERROR_WANT_WRITE:
-         logger_->warn("[{}] SSL read error {}", __func__, err);
-         [[fallthrough]];
-      case SSL_ERROR_ZERO_RETURN:
-         break;
-//      case SSL_ERROR_ZERO_RETURN:
-      case SSL_ERROR_SYSCALL:
-      case SSL_ERROR_SSL:
-         throw std::runtime_error("SSL read error " + std::to_string(err));
-      default: break;
+      if (conn->pending.empty()) {
+         if (conn->phase == Connection::Phase::Open) {
+            ++reusedCount_;
+         }
+         return conn;
       }
-      return {};
+      if (!leastLoaded || (conn->pending.size() < leastPending)) {
+         leastLoaded = conn;
+         leastPending = conn->pending.size();
+      }
+   }
+   // All connections are busy - pipeline the request if the pool is full
+   if (leastLoaded && (connections_.size() >= kMaxConnections)) {
+      ++reusedCount_;
+      return leastLoaded;
    }
-   return std::string(buf, len);
+
+   auto conn = std::make_shared<Connection>();
+   connections_.push_back(conn);
+   return conn;
 }
 
-void HttpsConnection::sendRequest(const std::string &data)
+void HttpsConnection::closeConnection(const std::shared_ptr<Connection> &conn)
 {
-   logger_->debug("[HttpsConnection] sending request:\n{}", data);
-   int len = 0;
-   while (len < (int)data.length()) {
-      if (!ssl_) {
-         len = -1;
+   {
+      std::lock_guard<std::mutex> lock(poolMutex_);
+      connections_.erase(std::remove(connections_.begin(), connections_.end(), conn)
+         , connections_.end());
+   }
+
+   std::deque<Connection::PendingRequest> pending;
+   uint64_t written = 0;
+   {
+      std::lock_guard<std::mutex> lock(conn->mutex);
+      if (conn->closed) {
+         return;
       }
-      else {
-         len = SSL_write(ssl_, data.c_str(), (int)data.length());
+      conn->closed = true;
+      conn->release();
+      pending.swap(conn->pending);
+      written = conn->written;
+   }
+
+   for (auto &request : pending) {
+      // Request not fully written yet could not be processed by the server, so it's
+      // retried once on another connection (server could drop kept-alive one)
+      if (!stopped_ && !request.attempt && (request.endPos > written)) {
+         enqueue(request.id, request.cb, request.data, request.attempt + 1);
+         continue;
+      }
+      if (request.cb) {
+         request.cb(0, {});
+      } else {
+         onRequestFailed();
       }
-      if (len < 0) {
-         int err = SSL_ERROR_SSL;
-         if (ssl_) {
-            err = SSL_get_error(ssl_, len);
+   }
+}
+
+void HttpsConnection::disconnectSocket()
+{
+   std::vector<std::shared_ptr<Connection>> connections;
+   {
+      std::lock_guard<std::mutex> lock(poolMutex_);
+      connections = connections_;
+   }
+   for (const auto &conn : connections) {
+      closeConnection(conn);
+   }
+}
+
+HttpsConnectionStats HttpsConnection::stats() const
+{
+   HttpsConnectionStats result;
+   result.connectsCount = connectsCount_;
+   result.resumedCount = resumedCount_;
+   result.requestsCount = requestsCount_;
+   result.reusedCount = reusedCount_;
+   return result;
+}
+
+void HttpsConnection::eventLoop()
+{
+   auto lastIdleCheck = std::chrono::steady_clock::now();
+
+   while (!stopped_) {
+      std::vector<std::shared_ptr<Connection>> connections;
+      {
+         std::lock_guard<std::mutex> lock(poolMutex_);
+         connections = connections_;
+      }
+
+      std::vector<std::shared_ptr<Connection>> polled;
+      std::vector<std::shared_ptr<Connection>> failed;
+      std::vector<pollfd> fds;
+      bool hasBuffered = false;
+      for (const auto &conn : connections) {
+         bool idle = false;
+         {
+            std::lock_guard<std::mutex> lock(conn->mutex);
+            if (conn->closed) {
+               continue;
+            }
+            idle = (conn->phase == Connection::Phase::Idle);
+         }
+         // Resolution is done without connection lock, so requests could be queued meanwhile
+         if (idle && !resolveHost()) {
+            failed.push_back(conn);
+            continue;
          }
-         switch (err) {
-         case SSL_ERROR_WANT_WRITE:
-            //logger_->warn("[{}] SSL want write", __func__);
+
+         std::lock_guard<std::mutex> lock(conn->mutex);
+         if (conn->closed) {
             continue;
-         case SSL_ERROR_WANT_READ:
-            //logger_->warn("[{}] SSL want read", __func__);
+         }
+         if ((conn->phase == Connection::Phase::Idle) && !startConnect(*conn)) {
+            failed.push_back(conn);
             continue;
-         case SSL_ERROR_ZERO_RETURN:
-         case SSL_ERROR_SYSCALL:
-         case SSL_ERROR_SSL:
+         }
+         pollfd fd;
+         fd.fd = conn->sock;
+         fd.revents = 0;
+         switch (conn->phase) {
+         case Connection::Phase::Connecting:
+            fd.events = POLLOUT;
+            break;
+         case Connection::Phase::Handshaking:
+            fd.events = conn->wantWrite ? POLLOUT : POLLIN;
+            break;
          default:
-            logger_->warn("[{}] SSL write error {}", __func__, err);
-            disconnectSocket();
-            std::this_thread::sleep_for(std::chrono::milliseconds{50});
-            try {
-               connectSocket();
+            fd.events = POLLIN;
+            if (conn->wantWrite) {
+               fd.events |= POLLOUT;
             }
-            catch (const std::exception& e) {
-               logger_->error("[HttpsConnection] failed to connect: {}", e.what());
+            // Data already decrypted by OpenSSL is not visible to poll
+            if (SSL_pending(conn->ssl) > 0) {
+               hasBuffered = true;
             }
-            continue;   // attempt to re-try
-            //throw std::runtime_error("SSL write error " + std::to_string(err));
+            break;
          }
+         fds.push_back(fd);
+         polled.push_back(conn);
       }
-      else if (len < data.length()) {
-         logger_->warn("[HttpsConnection] sent {} bytes vs {}", len, data.length());
+      for (const auto &conn : failed) {
+         closeConnection(conn);
+      }
+
+      if (fds.empty()) {
+         std::this_thread::sleep_for(std::chrono::milliseconds{ kPollTimeoutMs });
+         continue;
+      }
+
+      const int rc = pollSockets(fds.data(), fds.size(), hasBuffered ? 0 : kPollTimeoutMs);
+      if (rc < 0) {
+         logger_->error("[HttpsConnection] poll failed");
+         std::this_thread::sleep_for(std::chrono::milliseconds{ 50 });
+         continue;
+      }
+      for (size_t i = 0; i < fds.size(); ++i) {
+         bool open = false;
+         {
+            std::lock_guard<std::mutex> lock(polled[i]->mutex);
+            open = (polled[i]->phase == Connection::Phase::Open);
+         }
+         if (open) {
+            if (hasBuffered || fds[i].revents) {
+               readConnection(polled[i]);
+            }
+         }
+         else if (fds[i].revents && !continueConnect(polled[i])) {
+            closeConnection(polled[i]);
+         }
+      }
+
+      const auto now = std::chrono::steady_clock::now();
+      const bool checkIdle = (now - lastIdleCheck > std::chrono::seconds(1));
+      if (checkIdle) {
+         lastIdleCheck = now;
+      }
+      for (const auto &conn : polled) {
+         bool expired = false;
+         {
+            std::lock_guard<std::mutex> lock(conn->mutex);
+            if (conn->closed) {
+               continue;
+            }
+            if (conn->phase != Connection::Phase::Open) {
+               expired = (now > conn->connectDeadline);
+               if (expired) {
+                  logger_->error("[HttpsConnection] connection to {} timed out", host_);
+               }
+            }
+            else if (!conn->out.empty()) {
+               expired = (now - conn->lastActive > kWriteTimeout);
+               if (expired) {
+                  logger_->warn("[HttpsConnection] write to {} timed out", host_);
+               }
+            }
+            else {
+               expired = checkIdle && conn->pending.empty() && (now - conn->lastActive > kIdleTimeout);
+            }
+         }
+         if (expired) {
+            closeConnection(conn);
+         }
       }
    }
 }
 
+void HttpsConnection::readConnection(const std::shared_ptr<Connection> &conn)
+{
+   std::vector<CompletedResponse> completed;
+   std::string raw;
+   bool eof = false;
+   {
+      std::lock_guard<std::mutex> lock(conn->mutex);
+      if (conn->closed) {
+         return;
+      }
+      char buf[16 * 1024];
+      while (true) {
+         const int len = SSL_read(conn->ssl, buf, sizeof(buf));
+         if (len > 0) {
+            conn->buffer.append(buf, len);
+            continue;
+         }
+         const int err = SSL_get_error(conn->ssl, len);
+         if ((err == SSL_ERROR_WANT_READ) || (err == SSL_ERROR_WANT_WRITE)) {
+            break;
+         }
+         if (err != SSL_ERROR_ZERO_RETURN) {
+            logger_->debug("[HttpsConnection] SSL read error {}", err);
+         }
+         eof = true;
+         break;
+      }
+      // Write could wait for the socket to become readable or writable
+      if (!eof && !conn->out.empty() && !flushOut(*conn)) {
+         eof = true;
+      }
+
+      if (!conn->buffer.empty()) {
+         conn->lastActive = std::chrono::steady_clock::now();
+      }
+      conn->parse(completed, raw);
+      if (eof && (conn->state == Connection::State::BodyUntilClose)) {
+         conn->finish(completed);
+      }
+      // Server asked to close connection after the response
+      if (!conn->keepAlive && (conn->state == Connection::State::Headers)) {
+         eof = true;
+      }
+   }
+
+   try {
+      if (!raw.empty()) {
+         process(raw);
+      }
+      for (const auto &response : completed) {
+         response.cb(response.status, response.body);
+      }
+   }
+   catch (const std::exception &e) {
+      logger_->error("[HttpsConnection] {}", e.what());
+   }
+
+   if (eof) {
+      closeConnection(conn);
+   }
+}
+
+// Request is only queued, the caller never waits for the network
+void HttpsConnection::enqueue(uint64_t requestId, const ResponseCb &cb, const std::string &data
+   , unsigned attempt)
+{
+   // Connection could be closed by event loop after it was taken from the pool
+   for (int i = 0; i < 2; ++i) {
+      const auto conn = getConnection();
+      bool writeFailed = false;
+      {
+         std::lock_guard<std::mutex> lock(conn->mutex);
+         if (conn->closed) {
+            continue;
+         }
+         conn->queued += data.size();
+         conn->pending.push_back({ requestId, cb, data, conn->queued, attempt });
+         conn->out.append(data);
+         // Non-blocking write of what the socket accepts now, the rest is written by event loop
+         if (conn->phase == Connection::Phase::Open) {
+            writeFailed = !flushOut(*conn);
+         }
+      }
+      if (writeFailed) {
+         closeConnection(conn);
+      }
+      return;
+   }
+   if (cb) {
+      cb(0, {});
+   } else {
+      onRequestFailed();
+   }
+}
+
+void HttpsConnection::sendRequest(const std::string &data, const ResponseCb &cb)
+{
+   logger_->debug("[HttpsConnection] sending request:\n{}", data);
+   ++requestsCount_;
+   enqueue(nextRequestId_++, cb, data, 0);
+}
+
+void HttpsConnection::sendRequest(const std::string &data)
+{
+   sendRequest(data, nullptr);
+}
+
 void HttpsConnection::sendGetRequest(const std::string &request
    , const std::vector<std::string>& additionalHeaders)
+{
+   sendGetRequest(request, additionalHeaders, nullptr);
+}
+
+void HttpsConnection::sendGetRequest(const std::string &request
+   , const std::vector<std::string>& additionalHeaders, const ResponseCb &cb)
 {
    std::string decoratedReq = "GET " + request + " HTTP/1.1\r\n";
+   decoratedReq += "Host: " + host_ + "\r\n";
    decoratedReq += "User-Agent: BlockSettle connector v" + std::string(version) + "\r\n";
+   decoratedReq += "Connection: keep-alive\r\n";
    for (const auto& header : additionalHeaders) {
       decoratedReq += header + "\r\n";
    }
    decoratedReq += "\r\n";
-   sendRequest(decoratedReq);
+   sendRequest(decoratedReq, cb);
 }
 
 void HttpsConnection::sendPostRequest(const std::string &request, const std::string& body
    , const std::vector<std::string>& additionalHeaders)
+{
+   sendPostRequest(request, body, additionalHeaders, nullptr);
+}
+
+void HttpsConnection::sendPostRequest(const std::string &request, const std::string& body
+   , const std::vector<std::string>& additionalHeaders, const ResponseCb &cb)
 {
    auto decoratedReq = "POST " + request + " HTTP/1.1\r\n";
    decoratedReq += "Host: " + host_ + "\r\n";
    decoratedReq += "User-Agent: BlockSettle connector v" + std::string(version) + "\r\n";
    decoratedReq += "Accept: */*\r\n";
+   decoratedReq += "Connection: keep-alive\r\n";
    for (const auto& header : additionalHeaders) {
       decoratedReq += header + "\r\n";
    }
    decoratedReq += "\r\n";
    decoratedReq += body;
-   sendRequest(decoratedReq);
+   sendRequest(decoratedReq, cb);
 }
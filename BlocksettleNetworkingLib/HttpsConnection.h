@@ -12,7 +12,9 @@
 #define HTTPS_CONNECTION_H
 
 #include <atomic>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <unordered_map>
@@ -28,34 +30,90 @@ namespace spdlog {
 
 extern const char* version;
 
+struct HttpsConnectionStats
+{
+   uint64_t connectsCount{};     // TCP+TLS connections opened
+   uint64_t resumedCount{};      // connections opened with resumed TLS session
+   uint64_t requestsCount{};
+   uint64_t reusedCount{};       // requests sent over already opened connection
+};
+
+// Keeps a small pool of HTTP/1.1 keep-alive connections to the host.
+// New connections resume the last TLS session when server allows it.
+// Connections are opened (incl. TLS handshake) and read by a single non-blocking event loop
+// thread, requests are only queued by the caller, so several of them could be in flight.
 class HttpsConnection
 {
 public:
-   HttpsConnection(const std::shared_ptr<spdlog::logger> &, const std::string &host);
-   ~HttpsConnection();
+   // status is 0 if connection was lost before the full response was received
+   using ResponseCb = std::function<void(int status, const std::string &body)>;
+
+   HttpsConnection(const std::shared_ptr<spdlog::logger> &, const std::string &host
+      , uint16_t port = 443);
+   virtual ~HttpsConnection();
 
    void sendPostRequest(const std::string&, const std::string& body = {}
       , const std::vector<std::string>& additionalHeaders = {});
 
+   // Response is parsed and delivered to the callback (from the event loop thread), process() is not called
+   void sendPostRequest(const std::string&, const std::string& body
+      , const std::vector<std::string>& additionalHeaders, const ResponseCb &);
+   void sendGetRequest(const std::string&, const std::vector<std::string>& additionalHeaders
+      , const ResponseCb &);
+
+   HttpsConnectionStats stats() const;
+
 protected:
-   virtual void process(const std::string&) = 0;
+   // Receives raw response data for requests sent without callback
+   virtual void process(const std::string&) {}
+   // Called instead of process() if request without callback failed (connection lost
+   // before the full response or request could not be sent)
+   virtual void onRequestFailed() {}
    void sendGetRequest(const std::string&, const std::vector<std::string>& additionalHeaders = {});
    void sendRequest(const std::string&);
    void disconnectSocket();
 
 private:
-   std::string readSocket();
-   void connectSocket();
+   struct Connection;
+
+   bool resolveHost();
+   bool startConnect(Connection &);
+   bool continueConnect(const std::shared_ptr<Connection> &);
+   bool flushOut(Connection &);
+   std::shared_ptr<Connection> getConnection();
+   void closeConnection(const std::shared_ptr<Connection> &);
+   void sendRequest(const std::string &data, const ResponseCb &);
+   void enqueue(uint64_t requestId, const ResponseCb &, const std::string &data, unsigned attempt);
+   void readConnection(const std::shared_ptr<Connection> &);
+   void eventLoop();
+
+   static int onNewSession(SSL *, SSL_SESSION *);
 
 protected:
    std::shared_ptr<spdlog::logger>  logger_;
    const std::string host_;
+   const uint16_t    port_;
    SSL_CTX  *ctx_{ nullptr };
-   SSL      *ssl_{ nullptr };
    std::atomic_bool  stopped_{ false };
    std::atomic_bool  inRequest_{ true };
 
    std::unordered_map<std::string, std::string> accounts_;
+
+private:
+   std::mutex  poolMutex_;
+   std::vector<std::shared_ptr<Connection>>  connections_;
+
+   std::mutex     sessionMutex_;
+   SSL_SESSION    *session_{ nullptr };
+
+   std::thread    eventThread_;
+   uint32_t       hostAddr_{ 0 };   // resolved IPv4 address, event loop thread only
+   std::atomic<uint64_t>   nextRequestId_{ 1 };
+
+   std::atomic<uint64_t>   connectsCount_{};
+   std::atomic<uint64_t>   resumedCount_{};
+   std::atomic<uint64_t>   requestsCount_{};
+   std::atomic<uint64_t>   reusedCount_{};
 };
 
 #endif // HTTPS_CONNECTION_H
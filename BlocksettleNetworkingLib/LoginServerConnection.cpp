@@ -119,3 +119,13 @@ void LoginServerConnection::process(const std::string& data)
    }
    inRequest_ = false;
 }
+
+void LoginServerConnection::onRequestFailed()
+{
+   logger_->error("[LoginServerConnection::onRequestFailed] request {} failed"
+      , static_cast<int>(pendingRequest_));
+   pendingRequest_ = RequestType::Unknown;
+   bodyLen_ = 0;
+   body_.clear();
+   inRequest_ = false;
+}
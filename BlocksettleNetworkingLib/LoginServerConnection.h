@@ -50,6 +50,7 @@ public:
 
 protected:
    void process(const std::string&) override;
+   void onRequestFailed() override;
 
 private:
    LoginServerListener* listener_{ nullptr };
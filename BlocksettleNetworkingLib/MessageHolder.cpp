@@ -17,6 +17,11 @@ void delete_data(void *data, void *hint)
     delete[] static_cast<char*>(data);
 }
 
+void delete_string(void *data, void *hint)
+{
+    delete static_cast<std::string*>(hint);
+}
+
 MessageHolder::MessageHolder()
 {
    zmq_msg_init(&message);
@@ -30,6 +35,12 @@ MessageHolder::MessageHolder(const std::string& data)
    zmq_msg_init_data(&message, static_cast<void*>(buffer), data.size(), delete_data, nullptr);
 }
 
+MessageHolder::MessageHolder(std::string&& data)
+{
+   auto holder = new std::string(std::move(data));
+   zmq_msg_init_data(&message, &(*holder)[0], holder->size(), delete_string, holder);
+}
+
 MessageHolder::~MessageHolder() noexcept
 {
    zmq_msg_close(&message);
@@ -18,6 +18,8 @@ class MessageHolder {
 public:
     MessageHolder();
     MessageHolder(const std::string& data);
+    // Takes ownership of the buffer, ZMQ frees it once the frame is sent
+    explicit MessageHolder(std::string&& data);
     ~MessageHolder() noexcept;
     MessageHolder(MessageHolder&&);
 
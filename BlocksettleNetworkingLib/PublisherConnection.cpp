@@ -12,12 +12,20 @@
 
 #include "FastLock.h"
 #include "MessageHolder.h"
+#include "ZmqHelperFunctions.h"
 //BinaryData - for debug purpose only
 #include "BinaryData.h"
 
 #include <zmq.h>
 #include <spdlog/spdlog.h>
 
+namespace {
+
+   // Retry interval for topic updates blocked by subscribers HWM
+   const int kBlockedTopicsRetryMs = 10;
+
+} // namespace
+
 PublisherConnection::PublisherConnection(const std::shared_ptr<spdlog::logger>& logger
       , const std::shared_ptr<ZmqContext>& context)
    : logger_{logger}
@@ -206,7 +214,7 @@ void PublisherConnection::listenFunction()
    int errorCount = 0;
 
    while(true) {
-      result = zmq_poll(poll_items, 2, -1);
+      result = zmq_poll(poll_items, 2, topicsBlocked_ ? kBlockedTopicsRetryMs : -1);
       if (result == -1) {
          errorCount++;
          if ((zmq_errno() != EINTR) || (errorCount > 10)) {
@@ -221,6 +229,13 @@ void PublisherConnection::listenFunction()
 
       errorCount = 0;
 
+      if (result == 0) {
+         if (topicsBlocked_) {
+            BroadcastPendingData();
+         }
+         continue;
+      }
+
       if (poll_items[PublisherConnection::ControlSocketIndex].revents & ZMQ_POLLIN) {
          MessageHolder   command;
 
@@ -311,29 +326,95 @@ void PublisherConnection::stopServer()
 void PublisherConnection::BroadcastPendingData()
 {
    std::deque<std::string> pendingData;
+   std::deque<std::string> pendingTopics;
+   std::unordered_map<std::string, std::string> pendingTopicData;
 
    {
       FastLock locker{dataQueueLock_};
       pendingData.swap(dataQueue_);
+      pendingTopics.swap(topicQueue_);
+      pendingTopicData.swap(topicData_);
    }
 
-   for (const auto &data : pendingData) {
-      auto result = zmq_send(dataSocket_.get(), data.c_str(), data.size(), 0);
-      if (result != data.size()) {
+   for (size_t i = 0; i < pendingData.size(); ++i) {
+      auto &data = pendingData[i];
+      const auto dataSize = data.size();
+      auto result = bs::network::sendFrame(dataSocket_.get(), std::move(data), 0);
+      if (result != dataSize) {
          logger_->error("[PublisherConnection::SendDataToDataSocket] {} failed to send client id {}. {} packets dropped"
             , connectionName_, zmq_strerror(zmq_errno())
-            , pendingData.size());
+            , pendingData.size() - i);
+         droppedCount_ += pendingData.size() - i;
          break;
       }
+      ++publishedCount_;
+   }
+
+   BroadcastTopicData(pendingTopics, pendingTopicData);
+}
+
+void PublisherConnection::BroadcastTopicData(std::deque<std::string> &topics
+   , std::unordered_map<std::string, std::string> &topicData)
+{
+   topicsBlocked_ = false;
+
+   while (!topics.empty()) {
+      const auto &topic = topics.front();
+      auto itData = topicData.find(topic);
+
+      // XPUB_NODROP is set, so EAGAIN means some subscriber reached HWM
+      int result = zmq_send(dataSocket_.get(), topic.data(), topic.size(), ZMQ_SNDMORE | ZMQ_DONTWAIT);
+      if (result != topic.size()) {
+         if (zmq_errno() == EAGAIN) {
+            topicsBlocked_ = true;
+            break;
+         }
+         logger_->error("[PublisherConnection::BroadcastTopicData] {} failed to send topic {}: {}"
+            , connectionName_, topic, zmq_strerror(zmq_errno()));
+         ++droppedCount_;
+      } else {
+         const auto dataSize = itData->second.size();
+         result = bs::network::sendFrame(dataSocket_.get(), std::move(itData->second), 0);
+         if (result != dataSize) {
+            logger_->error("[PublisherConnection::BroadcastTopicData] {} failed to send {} data: {}"
+               , connectionName_, topic, zmq_strerror(zmq_errno()));
+            ++droppedCount_;
+         } else {
+            ++publishedCount_;
+         }
+      }
+
+      topicData.erase(itData);
+      topics.pop_front();
+   }
+
+   if (topics.empty()) {
+      return;
+   }
+
+   // Put unsent updates back in front of the queue, unless newer ones were published meanwhile
+   FastLock locker{dataQueueLock_};
+   for (auto it = topics.rbegin(); it != topics.rend(); ++it) {
+      auto inserted = topicData_.emplace(*it, std::move(topicData[*it]));
+      if (inserted.second) {
+         topicQueue_.push_front(std::move(*it));
+      } else {
+         ++conflatedCount_;
+      }
    }
 }
 
 bool PublisherConnection::PublishData(const std::string& data)
+{
+   return PublishData(std::string(data));
+}
+
+bool PublisherConnection::PublishData(std::string&& data)
 {
    assert(dataSocket_ != nullptr);
    {
       FastLock locker{dataQueueLock_};
-      dataQueue_.emplace_back( data );
+      dataQueue_.emplace_back( std::move(data) );
    }
 
    int command = PublisherConnection::CommandSend;
@@ -346,3 +427,39 @@ bool PublisherConnection::PublishData(const std::string& data)
 
    return result != -1;
 }
+
+bool PublisherConnection::PublishTopicData(const std::string& topic, std::string&& data)
+{
+   assert(dataSocket_ != nullptr);
+   {
+      FastLock locker{dataQueueLock_};
+      auto it = topicData_.find(topic);
+      if (it != topicData_.end()) {
+         // Previous value is still pending, send is already scheduled
+         it->second = std::move(data);
+         ++conflatedCount_;
+         return true;
+      }
+      topicData_.emplace(topic, std::move(data));
+      topicQueue_.push_back(topic);
+   }
+
+   int command = PublisherConnection::CommandSend;
+   int result = 0;
+
+   {
+      FastLock locker{controlSocketLockFlag_};
+      result = zmq_send(threadMasterSocket_.get(), static_cast<void*>(&command), sizeof(command), 0);
+   }
+
+   return result != -1;
+}
+
+PublisherStats PublisherConnection::stats() const
+{
+   PublisherStats result;
+   result.publishedCount = publishedCount_;
+   result.conflatedCount = conflatedCount_;
+   result.droppedCount = droppedCount_;
+   return result;
+}
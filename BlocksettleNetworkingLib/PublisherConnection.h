@@ -17,6 +17,16 @@
 #include <deque>
 #include <string>
 #include <thread>
+#include <unordered_map>
+
+struct PublisherStats
+{
+   uint64_t publishedCount{};
+   // topic updates replaced by a newer value before they were sent
+   uint64_t conflatedCount{};
+   // updates lost because of send errors
+   uint64_t droppedCount{};
+};
 
 class PublisherConnection
 {
@@ -42,6 +52,15 @@ public:
    bool BindPublishingConnection(const std::string& endpoint_name);
 
    bool PublishData(const std::string& data);
+   // Data buffer is moved through the queue to ZMQ without copying
+   bool PublishData(std::string&& data);
+
+   // Sent as [topic][data] multipart message, so subscribers could filter by topic.
+   // Only latest value is kept for each topic: if previous update is not sent yet
+   // (listen thread is busy or slow subscribers reached HWM) it is replaced.
+   bool PublishTopicData(const std::string& topic, std::string&& data);
+
+   PublisherStats stats() const;
 
 private:
    void stopServer();
@@ -61,6 +80,8 @@ private:
    };
 
    void BroadcastPendingData();
+   void BroadcastTopicData(std::deque<std::string> &topics
+      , std::unordered_map<std::string, std::string> &topicData);
 
    void ReadReceivedData();
 
@@ -81,6 +102,15 @@ private:
 
    std::atomic_flag                 dataQueueLock_ = ATOMIC_FLAG_INIT;
    std::deque<std::string>          dataQueue_;
+   // latest pending update for each topic, and topics in publish order
+   std::unordered_map<std::string, std::string> topicData_;
+   std::deque<std::string>          topicQueue_;
+   // set in listen thread if topic updates are waiting for subscribers to catch up
+   bool                             topicsBlocked_ = false;
+
+   std::atomic<uint64_t>            publishedCount_{0};
+   std::atomic<uint64_t>            conflatedCount_{0};
+   std::atomic<uint64_t>            droppedCount_{0};
    std::string                      connectionName_;
 
    mutable std::atomic_flag         welcomeMessageLock_ = ATOMIC_FLAG_INIT;
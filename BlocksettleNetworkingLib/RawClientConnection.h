@@ -39,6 +39,15 @@ namespace bs {
 
       public:
          bool send(const std::string& data) override
+         {
+            std::string rawData;
+            if (!frameData(data, rawData)) {
+               return false;
+            }
+            return _S::sendRawData(std::move(rawData));
+         }
+
+         bool frameData(const std::string& data, std::string& rawData) const override
          {
             auto size = data.size();
             char sizeBuffer[4];
@@ -58,7 +67,10 @@ namespace bs {
                sizeBuffer[bufferLength] |= 0x80;
                ++bufferLength;
             }
-            return _S::sendRawData(std::string((char*)sizeBuffer, bufferLength + 1) + data);
+            rawData.reserve(bufferLength + 1 + data.size());
+            rawData.assign(sizeBuffer, bufferLength + 1);
+            rawData.append(data);
+            return true;
          }
 
       protected:
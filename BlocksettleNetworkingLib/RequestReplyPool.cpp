@@ -0,0 +1,302 @@
+/*
+
+***********************************************************************************
+* Copyright (C) 2021, BlockSettle AB
+* Distributed under the GNU Affero General Public License (AGPL v3)
+* See LICENSE or http://www.gnu.org/licenses/agpl.html
+*
+**********************************************************************************
+
+*/
+#include "RequestReplyPool.h"
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+
+#include <spdlog/spdlog.h>
+
+#include "DataConnection.h"
+#include "DataConnectionListener.h"
+
+class RequestReplyPool::PooledConnection : public DataConnectionListener
+{
+public:
+   explicit PooledConnection(RequestReplyPool *owner)
+      : owner_(owner)
+   {}
+
+   ~PooledConnection() noexcept override
+   {
+      std::shared_ptr<DataConnection> connection;
+      std::shared_ptr<DataConnection> staleConnection;
+      {
+         std::lock_guard<std::mutex> lock(mutex_);
+         connection = std::move(connection_);
+         staleConnection = std::move(staleConnection_);
+      }
+      if (connection) {
+         connection->closeConnection();
+      }
+      failAll("request pool destroyed");
+   }
+
+   size_t pending() const
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return requests_.size();
+   }
+
+   // Request ID is assigned under the lock, so IDs are increasing in send order
+   // (FIFO matching relies on that). No I/O is done with the lock held, as
+   // connection could invoke callbacks synchronously.
+   std::future<std::string> execute(const std::string &data)
+   {
+      std::promise<std::string> promise;
+      auto result = promise.get_future();
+
+      // Connection which failed in its own callback could be released only here
+      std::shared_ptr<DataConnection> staleConnection;
+      bool needConnect = false;
+      {
+         std::lock_guard<std::mutex> lock(mutex_);
+         staleConnection = std::move(staleConnection_);
+
+         const auto id = owner_->nextRequestId_++;
+         requests_.emplace(id, std::move(promise));
+         sendQueue_.emplace_back(id, owner_->tagRequest_ ? owner_->tagRequest_(id, data) : data);
+
+         if (state_ == State::Disconnected) {
+            state_ = State::Connecting;
+            needConnect = true;
+         }
+      }
+
+      if (needConnect) {
+         connect();
+      } else {
+         flushQueue();
+      }
+      return result;
+   }
+
+   void OnDataReceived(const std::string& data) override
+   {
+      OnDataReceivedOwned(std::string(data));
+   }
+
+   void OnDataReceivedOwned(std::string&& data) override
+   {
+      std::promise<std::string> promise;
+      {
+         std::lock_guard<std::mutex> lock(mutex_);
+         if (owner_->untagReply_) {
+            uint64_t id = 0;
+            std::string payload;
+            if (!owner_->untagReply_(data, id, payload)) {
+               SPDLOG_LOGGER_ERROR(owner_->logger_, "{}: malformed reply", owner_->name_);
+               return;
+            }
+            auto it = requests_.find(id);
+            if (it == requests_.end()) {
+               SPDLOG_LOGGER_ERROR(owner_->logger_, "{}: unexpected reply {}", owner_->name_, id);
+               return;
+            }
+            promise = std::move(it->second);
+            requests_.erase(it);
+            data = std::move(payload);
+         } else {
+            // IDs are increasing, so the oldest request is the first one
+            if (requests_.empty()) {
+               SPDLOG_LOGGER_ERROR(owner_->logger_, "{}: reply without request", owner_->name_);
+               return;
+            }
+            promise = std::move(requests_.begin()->second);
+            requests_.erase(requests_.begin());
+         }
+      }
+      promise.set_value(std::move(data));
+   }
+
+   void OnConnected() override
+   {
+      {
+         std::lock_guard<std::mutex> lock(mutex_);
+         if (state_ != State::Connecting) {
+            return;
+         }
+         state_ = State::Connected;
+      }
+      flushQueue();
+   }
+
+   void OnDisconnected() override
+   {
+      onFailure(owner_->name_ + ": disconnected from server without reply");
+   }
+
+   void OnError(DataConnectionError errorCode) override
+   {
+      if (errorCode == NoError) {
+         return;
+      }
+      onFailure(owner_->name_ + ": get error from data connection " + std::to_string(errorCode));
+   }
+
+private:
+   enum class State
+   {
+      Disconnected,
+      Connecting,
+      Connected,
+   };
+
+   void connect()
+   {
+      auto connection = owner_->connectionFactory_();
+      if (!connection) {
+         onFailure(owner_->name_ + ": failed to create connection", nullptr);
+         return;
+      }
+      {
+         std::lock_guard<std::mutex> lock(mutex_);
+         if (state_ != State::Connecting) {
+            return;
+         }
+         connection_ = connection;
+      }
+      // OnConnected or OnError could be called from inside
+      if (!connection->openConnection(owner_->host_, owner_->port_, this)) {
+         onFailure(owner_->name_ + ": failed to open connection to " + owner_->host_
+            + ":" + owner_->port_, connection.get());
+      }
+   }
+
+   // Sends queued requests in order. Only one thread sends at a time, others just queue.
+   void flushQueue()
+   {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (sending_) {
+         return;
+      }
+      sending_ = true;
+      while ((state_ == State::Connected) && !sendQueue_.empty()) {
+         auto data = std::move(sendQueue_.front().second);
+         sendQueue_.pop_front();
+         auto connection = connection_;
+
+         lock.unlock();
+         const bool sent = connection->send(data);
+         if (!sent) {
+            // Replies could not be matched after a gap in FIFO mode, so all requests fail
+            onFailure(owner_->name_ + ": failed to send request", connection.get());
+         }
+         lock.lock();
+      }
+      sending_ = false;
+   }
+
+   // If connection is set, failure is ignored if it's not the current connection anymore
+   void onFailure(const std::string &errorMessage, const DataConnection *connection = nullptr)
+   {
+      std::shared_ptr<DataConnection> prevStaleConnection;
+      {
+         std::lock_guard<std::mutex> lock(mutex_);
+         if (state_ == State::Disconnected) {
+            return;
+         }
+         if (connection && (connection != connection_.get())) {
+            return;
+         }
+         // Can't close connection from its own callback, next request (or dtor) will do it
+         prevStaleConnection = std::move(staleConnection_);
+         staleConnection_ = std::move(connection_);
+         state_ = State::Disconnected;
+         sendQueue_.clear();
+         failAllLocked(errorMessage);
+      }
+      SPDLOG_LOGGER_ERROR(owner_->logger_, "{}", errorMessage);
+   }
+
+   void failAll(const std::string &errorMessage)
+   {
+      std::lock_guard<std::mutex> lock(mutex_);
+      failAllLocked(errorMessage);
+   }
+
+   void failAllLocked(const std::string &errorMessage)
+   {
+      for (auto &request : requests_) {
+         request.second.set_exception(std::make_exception_ptr(std::runtime_error(errorMessage)));
+      }
+      requests_.clear();
+   }
+
+private:
+   RequestReplyPool *owner_{};
+
+   mutable std::mutex mutex_;
+   State state_{ State::Disconnected };
+   std::shared_ptr<DataConnection> connection_;
+   std::shared_ptr<DataConnection> staleConnection_;
+   // Requests not sent yet (ID and tagged data), in ID order
+   std::deque<std::pair<uint64_t, std::string>> sendQueue_;
+   bool sending_{ false };
+   std::map<uint64_t, std::promise<std::string>> requests_;
+};
+
+
+RequestReplyPool::RequestReplyPool(const std::string& name
+   , const std::string& host, const std::string& port
+   , const ConnectionFactory& connectionFactory
+   , const std::shared_ptr<spdlog::logger>& logger
+   , size_t poolSize)
+ : name_(name)
+ , host_(host)
+ , port_(port)
+ , connectionFactory_(connectionFactory)
+ , logger_(logger)
+{
+   for (size_t i = 0; i < std::max<size_t>(poolSize, 1); ++i) {
+      connections_.push_back(std::make_unique<PooledConnection>(this));
+   }
+}
+
+RequestReplyPool::~RequestReplyPool() noexcept = default;
+
+void RequestReplyPool::SetRequestIdCodec(const TagRequestCb& tagRequest, const UntagReplyCb& untagReply)
+{
+   if (!tagRequest || !untagReply) {
+      logger_->error("[RequestReplyPool::SetRequestIdCodec] {}: both callbacks must be set", name_);
+      return;
+   }
+   tagRequest_ = tagRequest;
+   untagReply_ = untagReply;
+}
+
+std::future<std::string> RequestReplyPool::ExecuteRequest(const std::string& data)
+{
+   // Least loaded connection gets the request
+   PooledConnection *target = nullptr;
+   size_t targetPending = 0;
+   for (const auto &connection : connections_) {
+      const auto pending = connection->pending();
+      if (!target || (pending < targetPending)) {
+         target = connection.get();
+         targetPending = pending;
+      }
+   }
+
+   return target->execute(data);
+}
+
+size_t RequestReplyPool::PendingRequests() const
+{
+   size_t result = 0;
+   for (const auto &connection : connections_) {
+      result += connection->pending();
+   }
+   return result;
+}
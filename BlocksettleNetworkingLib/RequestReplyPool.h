@@ -0,0 +1,83 @@
+/*
+
+***********************************************************************************
+* Copyright (C) 2021, BlockSettle AB
+* Distributed under the GNU Affero General Public License (AGPL v3)
+* See LICENSE or http://www.gnu.org/licenses/agpl.html
+*
+**********************************************************************************
+
+*/
+#ifndef __REQUEST_REPLY_POOL_H__
+#define __REQUEST_REPLY_POOL_H__
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace spdlog {
+   class logger;
+};
+
+class DataConnection;
+
+// RequestReplyPool - pooled alternative to RequestReplyCommand for many requests to the same server.
+//    Connections are opened on first use and kept open, so connect (and handshake) cost is paid once.
+//    Requests are pipelined: replies are matched to requests in FIFO order on each connection.
+//    If request ID codec is set, replies could come in any order and are matched by ID.
+//    Futures fail with std::runtime_error if connection is lost before reply.
+class RequestReplyPool
+{
+public:
+   using ConnectionFactory = std::function<std::shared_ptr<DataConnection>()>;
+   // Should wrap request data with ID (server must send it back with the reply)
+   using TagRequestCb = std::function<std::string(uint64_t id, const std::string &data)>;
+   // Should extract ID and payload from reply, return false if reply is malformed
+   using UntagReplyCb = std::function<bool(const std::string &reply, uint64_t &id, std::string &payload)>;
+
+public:
+   // name - only for debugging purposes
+   RequestReplyPool(const std::string& name
+      , const std::string& host, const std::string& port
+      , const ConnectionFactory& connectionFactory
+      , const std::shared_ptr<spdlog::logger>& logger
+      , size_t poolSize = 1);
+
+   ~RequestReplyPool() noexcept;
+
+   RequestReplyPool(const RequestReplyPool&) = delete;
+   RequestReplyPool& operator = (const RequestReplyPool&) = delete;
+
+   RequestReplyPool(RequestReplyPool&&) = delete;
+   RequestReplyPool& operator = (RequestReplyPool&&) = delete;
+
+   // Must be called before first request
+   void SetRequestIdCodec(const TagRequestCb& tagRequest, const UntagReplyCb& untagReply);
+
+   std::string GetName() const { return name_; }
+
+   std::future<std::string> ExecuteRequest(const std::string& data);
+
+   // Requests sent or queued but not replied yet
+   size_t PendingRequests() const;
+
+private:
+   class PooledConnection;
+
+   const std::string name_;
+   const std::string host_;
+   const std::string port_;
+   const ConnectionFactory connectionFactory_;
+   std::shared_ptr<spdlog::logger>  logger_;
+
+   TagRequestCb   tagRequest_;
+   UntagReplyCb   untagReply_;
+
+   std::vector<std::unique_ptr<PooledConnection>> connections_;
+   std::atomic<uint64_t> nextRequestId_{1};
+};
+
+#endif // __REQUEST_REPLY_POOL_H__
@@ -10,10 +10,283 @@
 */
 #include "RetryingDataConnection.h"
 
-#include "DispatchQueue.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <vector>
 
 #include <spdlog/spdlog.h>
 
+namespace {
+
+   int64_t steadyNowMs()
+   {
+      return std::chrono::duration_cast<std::chrono::milliseconds>(
+         std::chrono::steady_clock::now().time_since_epoch()).count();
+   }
+
+   // Single thread shared by all RetryingDataConnection instances.
+   // Reconnect timers are kept in a hashed timer wheel, so scheduling is O(1) for any number of connections.
+   // Only timer expiries run here, expired tasks must not block.
+   class RetryTimerWheel
+   {
+   public:
+      using Task = std::function<void()>;
+
+      static RetryTimerWheel &instance()
+      {
+         // Never destroyed: connections could still be alive during static destruction
+         static auto wheel = new RetryTimerWheel();
+         return *wheel;
+      }
+
+      void schedule(std::chrono::milliseconds delay, Task task)
+      {
+         const auto ticks = std::max<uint64_t>(1, (delay.count() + kTick.count() - 1) / kTick.count());
+         {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!timersCount_) {
+               nextTick_ = std::chrono::steady_clock::now() + kTick;
+            }
+            const auto slot = (currentSlot_ + ticks) % kSlots;
+            wheel_[slot].push_back({ (ticks - 1) / kSlots, std::move(task) });
+            ++timersCount_;
+         }
+         cv_.notify_one();
+      }
+
+   private:
+      RetryTimerWheel()
+         : wheel_(kSlots)
+      {
+         std::thread([this] {
+            run();
+         }).detach();
+      }
+
+      void run()
+      {
+         std::unique_lock<std::mutex> lock(mutex_);
+         while (true) {
+            if (timersCount_) {
+               cv_.wait_until(lock, nextTick_);
+            } else {
+               cv_.wait(lock, [this] { return timersCount_ != 0; });
+            }
+
+            std::deque<Task> ready;
+            const auto now = std::chrono::steady_clock::now();
+            while (timersCount_ && (now >= nextTick_)) {
+               currentSlot_ = (currentSlot_ + 1) % kSlots;
+               nextTick_ += kTick;
+               auto &slot = wheel_[currentSlot_];
+               for (auto it = slot.begin(); it != slot.end(); ) {
+                  if (it->rounds == 0) {
+                     ready.push_back(std::move(it->task));
+                     it = slot.erase(it);
+                     --timersCount_;
+                  } else {
+                     --it->rounds;
+                     ++it;
+                  }
+               }
+            }
+
+            lock.unlock();
+            for (const auto &task : ready) {
+               task();
+            }
+            lock.lock();
+         }
+      }
+
+      struct Timer
+      {
+         uint64_t rounds;
+         Task task;
+      };
+
+      static constexpr std::chrono::milliseconds kTick{50};
+      static constexpr size_t kSlots = 512;
+
+      std::mutex mutex_;
+      std::condition_variable cv_;
+      std::vector<std::vector<Timer>> wheel_;
+      size_t currentSlot_{};
+      size_t timersCount_{};
+      std::chrono::steady_clock::time_point nextTick_{};
+   };
+
+   // Small thread pool shared by all RetryingDataConnection instances for reconnects and
+   // inner connection events. Tasks of one connection are never run concurrently (see Context).
+   class SharedExecutor
+   {
+   public:
+      using Task = std::function<void()>;
+
+      static SharedExecutor &instance()
+      {
+         // Never destroyed, the same as RetryTimerWheel
+         static auto executor = new SharedExecutor();
+         return *executor;
+      }
+
+      void post(Task task)
+      {
+         {
+            std::lock_guard<std::mutex> lock(mutex_);
+            tasks_.push_back(std::move(task));
+         }
+         cv_.notify_one();
+      }
+
+   private:
+      SharedExecutor()
+      {
+         for (unsigned i = 0; i < kThreads; ++i) {
+            std::thread([this] {
+               run();
+            }).detach();
+         }
+      }
+
+      void run()
+      {
+         while (true) {
+            Task task;
+            {
+               std::unique_lock<std::mutex> lock(mutex_);
+               cv_.wait(lock, [this] { return !tasks_.empty(); });
+               task = std::move(tasks_.front());
+               tasks_.pop_front();
+            }
+            task();
+         }
+      }
+
+      // Reconnect could block in inner openConnection, so other connections use other threads
+      static constexpr unsigned kThreads = 4;
+
+      std::mutex mutex_;
+      std::condition_variable cv_;
+      std::deque<Task> tasks_;
+   };
+
+} // namespace
+
+// Runs tasks of one connection in order, without a dedicated thread.
+// If no task is running, post() runs the caller's task at once on the calling thread
+// (so send/open/close block the caller only), tasks queued meanwhile are handed to
+// the shared executor, so listener callbacks never run inside the caller's call.
+// Timer expiries and inner connection events use postAsync(), as the shared timer
+// thread and inner connection callbacks must not block or call back into the inner connection.
+struct RetryingDataConnection::Context
+{
+   using Task = std::function<void(RetryingDataConnection *)>;
+
+   explicit Context(RetryingDataConnection *owner)
+      : owner_(owner)
+   {}
+
+   static void post(const std::shared_ptr<Context> &context, Task task)
+   {
+      std::unique_lock<std::mutex> lock(context->mutex_);
+      if (context->running_) {
+         context->tasks_.push_back(std::move(task));
+         return;
+      }
+      auto owner = context->owner_;
+      if (!owner) {
+         return;
+      }
+      context->running_ = true;
+      context->runningThread_ = std::this_thread::get_id();
+      lock.unlock();
+
+      runTask(owner, task);
+
+      lock.lock();
+      finish(context, lock);
+   }
+
+   static void postAsync(const std::shared_ptr<Context> &context, Task task)
+   {
+      std::unique_lock<std::mutex> lock(context->mutex_);
+      context->tasks_.push_back(std::move(task));
+      if (context->running_) {
+         return;
+      }
+      context->running_ = true;
+      lock.unlock();
+
+      SharedExecutor::instance().post([context] {
+         context->drain(context);
+      });
+   }
+
+   // Waits for running tasks and disables the rest (called from owner's dtor)
+   void shutdown()
+   {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] {
+         return !running_ || (runningThread_ == std::this_thread::get_id());
+      });
+      owner_ = nullptr;
+      tasks_.clear();
+   }
+
+private:
+   static void runTask(RetryingDataConnection *owner, const Task &task)
+   {
+      try {
+         task(owner);
+      } catch (const std::exception &e) {
+         SPDLOG_LOGGER_ERROR(owner->logger_, "task failed: {}", e.what());
+      }
+   }
+
+   // Called on the executor thread
+   void drain(const std::shared_ptr<Context> &self)
+   {
+      std::unique_lock<std::mutex> lock(mutex_);
+      runningThread_ = std::this_thread::get_id();
+      while (owner_ && !tasks_.empty()) {
+         auto task = std::move(tasks_.front());
+         tasks_.pop_front();
+         auto owner = owner_;
+
+         lock.unlock();
+         runTask(owner, task);
+         lock.lock();
+      }
+      finish(self, lock);
+   }
+
+   // Should be called with mutex_ locked at the end of a run, passes queued tasks to the executor
+   static void finish(const std::shared_ptr<Context> &context, std::unique_lock<std::mutex> &lock)
+   {
+      if (context->owner_ && !context->tasks_.empty()) {
+         context->runningThread_ = {};
+         lock.unlock();
+         SharedExecutor::instance().post([context] {
+            context->drain(context);
+         });
+         return;
+      }
+      context->running_ = false;
+      context->runningThread_ = {};
+      context->cv_.notify_all();
+   }
+
+   std::mutex mutex_;
+   std::condition_variable cv_;
+   RetryingDataConnection *owner_;
+   std::deque<Task> tasks_;
+   bool running_{false};
+   std::thread::id runningThread_;
+};
+
 class RetryingDataConnectionListener : public DataConnectionListener
 {
 public:
@@ -22,50 +295,69 @@ public:
       owner_->listener_->OnDataReceived(data);
    }
 
+   void OnDataReceivedOwned(std::string&& data) override
+   {
+      owner_->listener_->OnDataReceivedOwned(std::move(data));
+   }
+
    void OnConnected() override
    {
-      owner_->queue_->dispatch([this] {
-         owner_->onConnected();
+      dispatch([](RetryingDataConnection *owner) {
+         owner->onConnected();
       });
    }
 
    void OnDisconnected() override
    {
-      owner_->queue_->dispatch([this] {
-         owner_->onDisconnected();
+      dispatch([](RetryingDataConnection *owner) {
+         owner->onDisconnected();
       });
    }
 
    void OnError(DataConnectionError errorCode) override
    {
-      owner_->queue_->dispatch([this, errorCode] {
-         owner_->onError(errorCode);
+      dispatch([errorCode](RetryingDataConnection *owner) {
+         owner->onError(errorCode);
       });
    }
 
+   void dispatch(RetryingDataConnection::Context::Task cb)
+   {
+      RetryingDataConnection::Context::postAsync(context_, std::move(cb));
+   }
+
    RetryingDataConnection *owner_{};
+   std::shared_ptr<RetryingDataConnection::Context> context_;
 };
 
 RetryingDataConnection::RetryingDataConnection(const std::shared_ptr<spdlog::logger>& logger
    , RetryingDataConnectionParams params)
    : logger_(logger)
    , params_(std::move(params))
+   , context_(std::make_shared<Context>(this))
 {
    ownListener_ = std::make_unique<RetryingDataConnectionListener>();
    ownListener_->owner_ = this;
+   ownListener_->context_ = context_;
 }
 
 RetryingDataConnection::~RetryingDataConnection()
 {
-   shuttingDown_ = true;
    closeConnection();
+   context_->shutdown();
 }
 
 bool RetryingDataConnection::send(const std::string &data)
 {
-   queue_->dispatch([this, data] {
-      packets_.push(data);
-      trySendPackets();
+   if (!isActive()) {
+      return false;
+   }
+   Context::post(context_, [data](RetryingDataConnection *owner) {
+      if (owner->state_ == State::Idle) {
+         return;
+      }
+      owner->packets_.push(data);
+      owner->trySendPackets();
    });
    return true;
 }
@@ -74,43 +366,56 @@ bool RetryingDataConnection::openConnection(const std::string &host, const std::
    , DataConnectionListener *listener)
 {
    closeConnection();
+   active_ = true;
 
-   queue_ = std::make_unique<DispatchQueue>();
-
-   thread_ = std::thread([this] {
-      while (!queue_->done()) {
-         queue_->tryProcess(params_.periodicCheckTime);
-         tryReconnectIfNeeded();
-      }
-   });
-
-   queue_->dispatch([this, host, port, listener] {
-      host_ = host;
-      port_ = port;
-      listener_ = listener;
-      restart();
+   Context::post(context_, [host, port, listener](RetryingDataConnection *owner) {
+      owner->host_ = host;
+      owner->port_ = port;
+      owner->listener_ = listener;
+      owner->failedAttempts_ = 0;
+      owner->wasConnected_ = false;
+      owner->restart();
    });
    return true;
 }
 
+// Does not wait if other task of the connection is running, inner connection is closed after it then
 bool RetryingDataConnection::closeConnection()
 {
-   if (!isActive()) {
+   if (!active_.exchange(false)) {
       return false;
    }
 
-   queue_->dispatch([this] {
-      params_.connection->closeConnection();
+   Context::post(context_, [](RetryingDataConnection *owner) {
+      owner->state_ = State::Idle;
+      ++owner->restartGeneration_;
+      owner->packets_ = {};
+      owner->params_.connection->closeConnection();
+
+      const auto since = owner->disconnectedSinceMs_.exchange(0);
+      if (since) {
+         owner->disconnectedMs_ += steadyNowMs() - since;
+      }
    });
-   queue_->quit();
-   thread_.join();
-   state_ = State::Idle;
    return true;
 }
 
 bool RetryingDataConnection::isActive() const
 {
-   return thread_.joinable();
+   return active_;
+}
+
+RetryingDataConnectionStats RetryingDataConnection::stats() const
+{
+   RetryingDataConnectionStats result;
+   result.reconnectAttempts = reconnectAttempts_;
+   result.reconnectsCount = reconnectsCount_;
+   result.disconnectedMs = disconnectedMs_;
+   const auto since = disconnectedSinceMs_.load();
+   if (since) {
+      result.disconnectedMs += steadyNowMs() - since;
+   }
+   return result;
 }
 
 void RetryingDataConnection::trySendPackets()
@@ -126,45 +431,84 @@ void RetryingDataConnection::trySendPackets()
    }
 }
 
-void RetryingDataConnection::tryReconnectIfNeeded()
+void RetryingDataConnection::scheduleRestart()
 {
-   if (state_ == State::WaitingRestart && std::chrono::steady_clock::now() >= restartTime_ && !shuttingDown_) {
-      restart();
+   // Error and disconnect are usually reported together, single restart is enough
+   if (state_ == State::WaitingRestart) {
+      return;
+   }
+   if ((state_ == State::Connected) && !disconnectedSinceMs_) {
+      disconnectedSinceMs_ = steadyNowMs();
    }
+   state_ = State::WaitingRestart;
+
+   const auto generation = ++restartGeneration_;
+   RetryTimerWheel::instance().schedule(nextRestartDelay(), [context = context_, generation] {
+      Context::postAsync(context, [generation](RetryingDataConnection *owner) {
+         if ((owner->state_ != State::WaitingRestart) || (owner->restartGeneration_ != generation)) {
+            return;
+         }
+         ++owner->reconnectAttempts_;
+         owner->restart();
+      });
+   });
 }
 
-void RetryingDataConnection::scheduleRestart()
+std::chrono::milliseconds RetryingDataConnection::nextRestartDelay()
 {
-   state_ = State::WaitingRestart;
-   restartTime_ = std::chrono::steady_clock::now() + params_.restartTime;
+   const auto exponent = std::min(failedAttempts_++, 16u);
+   const auto maxDelay = std::max(params_.maxRestartTime, params_.restartTime);
+   const auto delay = std::min(params_.restartTime * (int64_t(1) << exponent), maxDelay);
+
+   const auto jitter = std::min(std::max(params_.restartJitter, 0.0), 1.0);
+   std::uniform_real_distribution<double> distribution(1.0 - jitter, 1.0);
+   return std::chrono::milliseconds(static_cast<int64_t>(delay.count() * distribution(random_)));
 }
 
 void RetryingDataConnection::restart()
 {
+   state_ = State::Connecting;
    bool result = params_.connection->openConnection(host_, port_, ownListener_.get());
    if (!result) {
       SPDLOG_LOGGER_ERROR(logger_, "opening connection failed");
       scheduleRestart();
-      return;
    }
-   state_ = State::Connecting;
 }
 
 void RetryingDataConnection::onConnected()
 {
+   if (state_ == State::Idle) {  // closed already
+      return;
+   }
    listener_->OnConnected();
    state_ = State::Connected;
+   failedAttempts_ = 0;
+   if (wasConnected_) {
+      ++reconnectsCount_;
+   }
+   wasConnected_ = true;
+
+   const auto since = disconnectedSinceMs_.exchange(0);
+   if (since) {
+      disconnectedMs_ += steadyNowMs() - since;
+   }
    trySendPackets();
 }
 
 void RetryingDataConnection::onDisconnected()
 {
+   if (state_ == State::Idle) {  // closed already
+      return;
+   }
    listener_->OnDisconnected();
    scheduleRestart();
 }
 
 void RetryingDataConnection::onError(DataConnectionListener::DataConnectionError errorCode)
 {
+   if (state_ == State::Idle) {  // closed already
+      return;
+   }
    listener_->OnError(errorCode);
    scheduleRestart();
 }
@@ -16,24 +16,37 @@
 #include <memory>
 #include <mutex>
 #include <queue>
-#include <thread>
+#include <random>
 
 #include "DataConnection.h"
 
-class DispatchQueue;
-
 struct RetryingDataConnectionParams
 {
+   // Delay before the first reconnect, doubled after each failed attempt up to maxRestartTime
    std::chrono::milliseconds restartTime{std::chrono::seconds(10)};
+   std::chrono::milliseconds maxRestartTime{std::chrono::minutes(2)};
+   // Delay is randomly reduced by up to this part, so connections to the same server don't reconnect at once
+   double restartJitter{0.5};
+   // Deprecated: ignored, kept for source compatibility (reconnects are scheduled by timers now)
    std::chrono::milliseconds periodicCheckTime{std::chrono::seconds(20)};
    std::unique_ptr<DataConnection> connection;
 };
 
+struct RetryingDataConnectionStats
+{
+   uint64_t reconnectAttempts{};
+   uint64_t reconnectsCount{};   // successful reconnects
+   uint64_t disconnectedMs{};    // total time spent disconnected, including current outage
+};
+
 namespace spdlog {
    class logger;
 }
 class RetryingDataConnectionListener;
 
+// All instances share a single timer thread for reconnects and a small executor for the
+// connection work: caller's own open/send/close is done on its thread, reconnects, inner
+// connection events and listener callbacks are done on the executor.
 class RetryingDataConnection : public DataConnection
 {
 public:
@@ -52,6 +65,8 @@ public:
 
    bool isActive() const override;
 
+   RetryingDataConnectionStats stats() const;
+
 private:
    friend class RetryingDataConnectionListener;
 
@@ -63,10 +78,12 @@ private:
       WaitingRestart,
    };
 
-   // Could be used from listening thread only
+   struct Context;
+
+   // Could be used from context tasks only
    void trySendPackets();
-   void tryReconnectIfNeeded();
    void scheduleRestart();
+   std::chrono::milliseconds nextRestartDelay();
    void restart();
 
    void onConnected();
@@ -76,18 +93,25 @@ private:
    std::shared_ptr<spdlog::logger> logger_;
    const RetryingDataConnectionParams params_;
 
-   std::unique_ptr<DispatchQueue> queue_;
-   std::thread thread_;
+   std::shared_ptr<Context> context_;
+   std::atomic_bool active_{false};
 
-   // Could be used from listening thread only
+   // Could be used from context tasks only
    std::queue<std::string> packets_;
    State state_{State::Idle};
-   std::chrono::steady_clock::time_point restartTime_{};
+   uint64_t restartGeneration_{};
+   unsigned failedAttempts_{};
+   bool wasConnected_{false};
+   std::mt19937 random_{std::random_device{}()};
    std::string host_;
    std::string port_{};
    std::unique_ptr<RetryingDataConnectionListener> ownListener_;
-   std::atomic_bool shuttingDown_{false};
 
+   std::atomic<uint64_t> reconnectAttempts_{};
+   std::atomic<uint64_t> reconnectsCount_{};
+   std::atomic<uint64_t> disconnectedMs_{};
+   // Steady clock time (ms) when current outage started, 0 if not disconnected
+   std::atomic<int64_t> disconnectedSinceMs_{};
 };
 
 #endif // RETRYING_DATA_CONNECTION_H
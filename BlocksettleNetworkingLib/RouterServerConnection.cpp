@@ -45,6 +45,11 @@ public:
       listener_->OnDataFromClient(getRouterClientId(index_, clientId), data);
    }
 
+   void OnDataFromClientOwned(const std::string& clientId, std::string&& data) override
+   {
+      listener_->OnDataFromClientOwned(getRouterClientId(index_, clientId), std::move(data));
+   }
+
    void OnClientConnected(const std::string& clientId, const Details &details) override
    {
       listener_->OnClientConnected(getRouterClientId(index_, clientId), details);
@@ -42,6 +42,10 @@ public:
 
    // Close client connection
    virtual bool closeClient(const std::string& /*clientId*/) { return false; }
+
+   // Called by wrappers keeping own per-client state (like BIP15x ciphers) which is not
+   // persisted, so sessions restored after restart could not be resumed through them
+   virtual void disableSessionRestore() {}
 };
 
 #endif // __SERVER_CONNECTION_H__
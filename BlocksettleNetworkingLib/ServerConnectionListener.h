@@ -42,6 +42,13 @@ public:
 
 public:
    virtual void OnDataFromClient(const std::string& clientId, const std::string& data) = 0;
+   // Called by connections which could give away the received buffer.
+   // Override to take ownership of the data without copying it. Has its own name,
+   // so overriding OnDataFromClient alone doesn't hide it.
+   virtual void OnDataFromClientOwned(const std::string& clientId, std::string&& data)
+   {
+      OnDataFromClient(clientId, data);
+   }
 
    virtual void OnClientConnected(const std::string &clientId, const Details &details) = 0;
    virtual void OnClientDisconnected(const std::string& clientId) = 0;
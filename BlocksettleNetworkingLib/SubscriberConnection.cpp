@@ -152,12 +152,23 @@ bool SubscriberConnection::ConnectToPublisherEndpoint(const std::string& endpoin
       return false;
    }
 
-   // subscribe to data (all messages, no filtering)
-   result = zmq_setsockopt(tempDataSocket.get(), ZMQ_SUBSCRIBE, nullptr, 0);
-   if (result != 0) {
-      logger_->error("[SubscriberConnection::ConnectToPublisherEndpoint] failed to subscribe: {}"
-         , zmq_strerror(zmq_errno()));
-      return false;
+   if (topics_.empty()) {
+      // subscribe to data (all messages, no filtering)
+      result = zmq_setsockopt(tempDataSocket.get(), ZMQ_SUBSCRIBE, nullptr, 0);
+      if (result != 0) {
+         logger_->error("[SubscriberConnection::ConnectToPublisherEndpoint] failed to subscribe: {}"
+            , zmq_strerror(zmq_errno()));
+         return false;
+      }
+   } else {
+      for (const auto &topic : topics_) {
+         result = zmq_setsockopt(tempDataSocket.get(), ZMQ_SUBSCRIBE, topic.data(), topic.size());
+         if (result != 0) {
+            logger_->error("[SubscriberConnection::ConnectToPublisherEndpoint] failed to subscribe {}: {}"
+               , topic, zmq_strerror(zmq_errno()));
+            return false;
+         }
+      }
    }
 
    // ok, move temp data to members
@@ -175,6 +186,15 @@ bool SubscriberConnection::ConnectToPublisherEndpoint(const std::string& endpoin
    return true;
 }
 
+void SubscriberConnection::SubscribeTopics(const std::vector<std::string>& topics)
+{
+   if (isActive()) {
+      logger_->error("[SubscriberConnection::SubscribeTopics] connection active.");
+      return;
+   }
+   topics_ = { topics.begin(), topics.end() };
+}
+
 void SubscriberConnection::stopListen()
 {
    listener_ = nullptr;
@@ -299,6 +319,28 @@ bool SubscriberConnection::recvData(const ZmqContext::sock_ptr& dataSocket)
       return false;
    }
 
+   if (!data.IsLast()) {
+      // [topic][data] message from PublishTopicData
+      MessageHolder topicData;
+      result = zmq_msg_recv(&topicData, dataSocket.get(), ZMQ_DONTWAIT);
+      if (result == -1) {
+         logger_->error("[SubscriberConnection::recvData] {} failed to recv topic data frame from stream: {}"
+            , connectionName_, zmq_strerror(zmq_errno()));
+         return false;
+      }
+
+      const auto topic = data.ToString();
+      // ZMQ subscription matches by prefix
+      if (!topics_.empty() && (topics_.find(topic) == topics_.end())) {
+         return true;
+      }
+
+      if (listener_) {
+         listener_->OnTopicDataReceived(topic, topicData.ToString());
+      }
+      return true;
+   }
+
    if (listener_) {
       listener_->OnDataReceived(data.ToString());
    }
@@ -16,6 +16,8 @@
 #include <atomic>
 #include <thread>
 #include <functional>
+#include <unordered_set>
+#include <vector>
 
 class SubscriberConnectionListener
 {
@@ -30,6 +32,11 @@ public:
    SubscriberConnectionListener& operator = (SubscriberConnectionListener&&) = delete;
 
    virtual void OnDataReceived(const std::string& data) = 0;
+   // Called for messages published with PublisherConnection::PublishTopicData
+   virtual void OnTopicDataReceived(const std::string& topic, const std::string& data)
+   {
+      OnDataReceived(data);
+   }
    virtual void OnConnected() = 0;
    virtual void OnDisconnected() = 0;
 };
@@ -81,6 +88,12 @@ public:
 
    void stopListen();
 
+   // Should be set before connecting. Receives everything if empty.
+   // Topics are matched exactly, not by prefix. Only PublishTopicData messages are received then:
+   // single-frame ones (PublishData and the welcome message) have no topic frame, so they are
+   // filtered out by the publisher as not matching any subscription.
+   void SubscribeTopics(const std::vector<std::string>& topics);
+
 private:
    void listenFunction();
 
@@ -114,6 +127,8 @@ private:
 
    std::thread                      listenThread_;
    SubscriberConnectionListener*    listener_ = nullptr;
+
+   std::unordered_set<std::string>  topics_;
 };
 
 #endif // __SUBSCRIBER_CONNECTION_H__
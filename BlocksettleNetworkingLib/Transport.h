@@ -37,7 +37,8 @@ namespace bs {
          using SendCb = std::function<bool(const std::string &)>;
          void setSendCb(const SendCb &cb) { sendCb_ = cb; }
 
-         using NotifyDataCb = std::function<void(const std::string &)>;
+         // Decrypted data is passed by value so it could be moved up to the listener
+         using NotifyDataCb = std::function<void(std::string)>;
          void setNotifyDataCb(const NotifyDataCb &cb) { notifyDataCb_ = cb; }
 
          using SocketErrorCb = std::function<void(DataConnectionListener::DataConnectionError)>;
@@ -65,7 +66,8 @@ namespace bs {
             , const ServerConnectionListener::Details &details)>;
          void setClientErrorCb(const ClientErrorCb &cb) { clientErrorCb_ = cb; }
 
-         using DataReceivedCb = std::function<void(const std::string &clientId, const std::string &data)>;
+         // Decrypted data is passed by value so it could be moved up to the listener
+         using DataReceivedCb = std::function<void(const std::string &clientId, std::string data)>;
          void setDataReceivedCb(const DataReceivedCb &cb) { dataReceivedCb_ = cb; }
 
          using SendDataCb = std::function<bool(const std::string &clientId, const std::string &data)>;
@@ -10,6 +10,7 @@
 */
 #include "TransportBIP15x.h"
 
+#include <algorithm>
 #include <chrono>
 
 #include "BIP150_151.h"
@@ -193,21 +194,46 @@ void TransportBIP15xClient::rekeyIfNeeded(size_t dataSize)
 
 bool TransportBIP15xClient::sendData(const std::string &data)
 {
+   std::lock_guard<std::mutex> lock(sendMutex_);
    if (!bip151Connection_ || (bip151Connection_->getBIP150State() != BIP150State::SUCCESS)) {
       SPDLOG_LOGGER_ERROR(logger_, "transport is not connected, sending packet failed");
       return false;
    }
 
+   if (params_.chunkedPackets && (data.size() > bip15x::ChunkSize)) {
+      // Only one chunk is encrypted at a time
+      const auto ptr = reinterpret_cast<const uint8_t*>(data.data());
+      for (size_t offset = 0; offset < data.size(); offset += bip15x::ChunkSize) {
+         const auto chunkSize = std::min(bip15x::ChunkSize, data.size() - offset);
+         rekeyIfNeeded(chunkSize);
+         bip15x::MessageBuilder::buildInto(sendBuffer_
+            , bip15x::MessageBuilder::chunkHeader(offset == 0, data.size())
+            , ptr + offset, static_cast<uint32_t>(chunkSize)
+            , static_cast<ArmoryAEAD::BIP151_PayloadType>(bip15x::ChunkedPacketType)
+            , bip151Connection_.get());
+         if (!sendPacket(sendBuffer_)) {
+            return false;
+         }
+      }
+      return true;
+   }
+
    rekeyIfNeeded(data.size());
 
-   auto packet = bip15x::MessageBuilder(BinaryData::fromString(data)
-      , ArmoryAEAD::BIP151_PayloadType::SinglePacket).encryptIfNeeded(bip151Connection_.get()).build();
+   bip15x::MessageBuilder::buildInto(sendBuffer_, reinterpret_cast<const uint8_t*>(data.data())
+      , static_cast<uint32_t>(data.size()), ArmoryAEAD::BIP151_PayloadType::SinglePacket
+      , bip151Connection_.get());
    // An error message is already logged elsewhere if the send fails.
-   sendPacket(packet);
+   sendPacket(sendBuffer_);
    return true;
 }
 
 bool TransportBIP15xClient::sendPacket(const BinaryData &packet, bool encrypted)
+{
+   return sendPacket(packet.toBinStr(), encrypted);
+}
+
+bool TransportBIP15xClient::sendPacket(const std::string &packet, bool encrypted)
 {
    if (!sendCb_) {
       logger_->error("[TransportBIP15xClient::sendPacket] send callback not set");
@@ -226,7 +252,7 @@ bool TransportBIP15xClient::sendPacket(const BinaryData &packet, bool encrypted)
       }
    }
 
-   return sendCb_(packet.toBinStr());
+   return sendCb_(packet);
 }
 
 void TransportBIP15xClient::rekey()
@@ -304,6 +330,7 @@ void TransportBIP15xClient::openConnection(const std::string &host
    auto lbds = getAuthPeerLambda();
    bool oneWay = (params_.authMode == BIP15xAuthMode::OneWay) ? true : false;
    bip151Connection_ = std::make_unique<BIP151Connection>(lbds, oneWay);
+   chunkAssembler_ = bip15x::ChunkAssembler(params_.maxChunkedMessageSize);
 }
 
 void TransportBIP15xClient::closeConnection()
@@ -360,6 +387,40 @@ void TransportBIP15xClient::processIncomingData(const BinaryData &payload)
       return;
    }
 
+   if (msg.getMsgType() == static_cast<ArmoryAEAD::BIP151_PayloadType>(bip15x::ChunkedPacketType)) {
+      if (!params_.chunkedPackets || !chunkAssembler_.add(inMsg)) {
+         logger_->error("[TransportBIP15xClient::processIncomingData] unexpected or invalid chunk");
+         if (socketErrorCb_) {
+            socketErrorCb_(DataConnectionListener::SerializationFailed);
+         }
+         return;
+      }
+      if (chunkAssembler_.complete()) {
+         auto message = chunkAssembler_.take();
+         if (notifyDataCb_) {
+            notifyDataCb_(std::move(message));
+         }
+      }
+      return;
+   }
+
+   if (msg.getMsgType() == static_cast<ArmoryAEAD::BIP151_PayloadType>(bip15x::BatchedPacketType)) {
+      std::vector<std::string> messages;
+      if (!params_.batchedPackets || !bip15x::MessageBatch::parse(inMsg, messages)) {
+         logger_->error("[TransportBIP15xClient::processIncomingData] unexpected or invalid batched packet");
+         if (socketErrorCb_) {
+            socketErrorCb_(DataConnectionListener::SerializationFailed);
+         }
+         return;
+      }
+      if (notifyDataCb_) {
+         for (auto &message : messages) {
+            notifyDataCb_(std::move(message));
+         }
+      }
+      return;
+   }
+
    // Pass the final data up the chain.
    if (notifyDataCb_) {
       notifyDataCb_(inMsg.toBinStr());
@@ -458,6 +519,15 @@ bool TransportBIP15xClient::processAEADHandshake(const bip15x::Message &msgObj)
       logger_->debug("[TransportBIP15xClient::processAEADHandshake] BIP 150 handshake"
          " with server complete - {} connection to {} is ready and fully secured"
          , connType, srvId);
+      // Announce before connected notification, so it precedes any data packet
+      if (params_.batchedPackets || params_.chunkedPackets) {
+         const uint8_t features = (params_.batchedPackets ? bip15x::FeatureBatching : 0)
+            | (params_.chunkedPackets ? bip15x::FeatureChunking : 0);
+         auto packet = bip15x::MessageBuilder(&features, sizeof(features), bip15x::BatchSupportType)
+            .encryptIfNeeded(bip151Connection_.get()).build();
+         sendPacket(packet);
+      }
+
       if (socketErrorCb_) {
          socketErrorCb_(DataConnectionListener::NoError);
       }
@@ -91,6 +91,18 @@ namespace bs {
          BIP15xAuthMode authMode = BIP15xAuthMode::TwoWay;
 
          std::chrono::milliseconds connectionTimeout{ std::chrono::seconds(10) };
+
+         // Announce to the server that batched packets are accepted (several messages
+         // in one AEAD record). Enable only for servers which support it,
+         // older ones drop connections on unknown packet types.
+         bool batchedPackets{ false };
+
+         // Send and receive messages above bip15x::ChunkSize in chunks. Same
+         // compatibility concern as above.
+         bool chunkedPackets{ false };
+
+         // Incoming chunked messages above that size are rejected
+         uint64_t maxChunkedMessageSize{ bip15x::DefaultMaxChunkedMessageSize };
       };
 
 
@@ -174,6 +186,7 @@ namespace bs {
          bool verifyNewIDKey(const BinaryDataRef &newKey, const std::string &srvId);
          void rekeyIfNeeded(size_t dataSize);
          bool sendPacket(const BinaryData &, bool encrypted = true);
+         bool sendPacket(const std::string &, bool encrypted = true);
          
       private:
          const BIP15xParams   params_;
@@ -182,6 +195,11 @@ namespace bs {
          std::string host_, port_;
          std::unique_ptr<BIP151Connection> bip151Connection_;
          std::chrono::time_point<std::chrono::steady_clock> outKeyTimePoint_;
+         // Serializes sendData, so packets are encrypted and passed to sendCb_ in the same order
+         std::mutex  sendMutex_;
+         // Reused for encrypted data packets, guarded by sendMutex_
+         std::string sendBuffer_;
+         bip15x::ChunkAssembler chunkAssembler_;
 
          BIP15xNewKeyCb cbNewKey_;
          bool gotKeyAnnounce_ = false;
@@ -14,13 +14,36 @@
 #include "MessageHolder.h"
 #include "StringUtils.h"
 #include "SystemFileUtils.h"
+#include "ThreadName.h"
 #include "BIP15x_Handshake.h"
 
+#include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
 
 using namespace Armory::Wallets;
 using namespace bs::network;
 
+namespace {
+
+   // Batch is sent when it reaches this size or after the deadline since first queued message.
+   // Messages are batched only if they follow previous record within the deadline, so
+   // a message on an idle connection is sent at once.
+   const size_t kBatchMaxSize = 16 * 1024;
+   const auto kBatchDeadline = std::chrono::milliseconds(2);
+
+} // namespace
+
+struct TransportBIP15xServer::CryptoWorker
+{
+   std::thread thread;
+   std::mutex mutex;
+   std::condition_variable cv;
+   std::deque<std::function<void()>> tasks;
+   bool stopped{ false };
+};
+
 // A call resetting the encryption-related data for individual connections.
 //
 // INPUT:  None
@@ -134,6 +157,25 @@ TransportBIP15xServer::TransportBIP15xServer(const std::shared_ptr<spdlog::logge
 
 TransportBIP15xServer::~TransportBIP15xServer() noexcept
 {
+   // Workers use connections and callbacks, stop them first.
+   // Crypto workers post to handshake workers, so they are stopped first. Vectors are
+   // cleared only when all threads are joined, as workers check them while running.
+   std::vector<std::shared_ptr<BIP15xPerConnData>> connections;
+   {
+      std::lock_guard<std::mutex> lock(connMapMutex_);
+      for (const auto &conn : socketConnMap_) {
+         connections.push_back(conn.second);
+      }
+   }
+   for (const auto &connection : connections) {
+      flushPendingBatch(connection);
+   }
+   stopBatchFlush();
+   stopWorkers(cryptoWorkers_);
+   stopWorkers(handshakeWorkers_);
+   cryptoWorkers_.clear();
+   handshakeWorkers_.clear();
+
    // TODO: Send disconnect messages to the clients
 
    // If it exists, delete the identity cookie.
@@ -181,6 +223,7 @@ void TransportBIP15xServer::forceTrustedClients(const BIP15xPeers &peers)
 
 std::unique_ptr<BIP15xPeer> TransportBIP15xServer::getClientKey(const std::string &clientId) const
 {
+   std::lock_guard<std::mutex> lock(connMapMutex_);
    auto it = socketConnMap_.find(clientId);
    if (it == socketConnMap_.end() || !handshakeCompleted(it->second->encData_.get())) {
       return nullptr;
@@ -212,13 +255,37 @@ void TransportBIP15xServer::startHandshake(const std::string &clientID)
 // RETURN: None
 void TransportBIP15xServer::processIncomingData(const std::string &encData
    , const std::string &clientID)
+{
+   if (postToCryptoWorker(clientID, [this, encData, clientID] {
+      processIncomingDataImpl(encData, clientID);
+   })) {
+      return;
+   }
+   processIncomingDataImpl(encData, clientID);
+}
+
+void TransportBIP15xServer::processIncomingDataImpl(const std::string &encData
+   , const std::string &clientID, bool onHandshakeThread)
 {
    const auto &connData = GetConnection(clientID);
-   assert(connData);
+   if (!connData) {
+      SPDLOG_LOGGER_ERROR(logger_, "unknown connection {}", bs::toHex(clientID));
+      return;
+   }
    if (!connData->isValid) {
       return;
    }
 
+   // Until handshake is done (and its last step is processed) all packets go through
+   // the handshake executor to keep them ordered with cipher state changes
+   if (!onHandshakeThread && !handshakeWorkers_.empty()
+      && (!connData->handshakeDone_ || (connData->handshakeTasks_ > 0))) {
+      postHandshake(connData, [this, encData, clientID] {
+         processIncomingDataImpl(encData, clientID, true);
+      });
+      return;
+   }
+
    auto payload = BinaryData::fromString(encData);
 
    // Decrypt only if the BIP 151 handshake is complete.
@@ -267,6 +334,38 @@ void TransportBIP15xServer::processIncomingData(const std::string &encData
       return;
    }
 
+   if (msg.getMsgType() == static_cast<ArmoryAEAD::BIP151_PayloadType>(bip15x::BatchSupportType)) {
+      // Empty payload is sent by clients supporting batching only
+      const uint8_t features = (outMsg.getSize() == 0) ? bip15x::FeatureBatching : outMsg.getPtr()[0];
+      std::lock_guard<std::mutex> lock(connData->sendMutex_);
+      connData->batching_ = (features & bip15x::FeatureBatching) != 0;
+      connData->chunking_ = (features & bip15x::FeatureChunking) != 0;
+      connData->chunkAssembler_.setMaxSize(maxChunkedMessageSize_);
+      SPDLOG_LOGGER_DEBUG(logger_, "client {} accepts batched: {}, chunked: {} packets"
+         , bs::toHex(clientID), connData->batching_, connData->chunking_);
+      return;
+   }
+   if (msg.getMsgType() == static_cast<ArmoryAEAD::BIP151_PayloadType>(bip15x::ChunkedPacketType)) {
+      if (!connData->chunking_ || !connData->chunkAssembler_.add(outMsg)) {
+         logger_->error("[TransportBIP15xServer::processIncomingData] unexpected or invalid chunk");
+         reportFatalError(connData);
+         return;
+      }
+      if (connData->chunkAssembler_.complete()) {
+         auto message = connData->chunkAssembler_.take();
+         if (dataReceivedCb_) {
+            dataReceivedCb_(clientID, std::move(message));
+         }
+      }
+      return;
+   }
+   if (msg.getMsgType() == static_cast<ArmoryAEAD::BIP151_PayloadType>(bip15x::BatchedPacketType)) {
+      logger_->error("[TransportBIP15xServer::processIncomingData] batched packets"
+         " from clients are not supported");
+      reportFatalError(connData);
+      return;
+   }
+
    // Pass the final data up the chain.
    if (dataReceivedCb_) {
       dataReceivedCb_(clientID, outMsg.toBinStr());
@@ -343,7 +442,24 @@ bool TransportBIP15xServer::processAEADHandshake(const bip15x::Message &msgObj
 
    case ArmoryAEAD::HandshakeState::Completed:
    {
+      // Peer key is known only after BIP 150 is done. handshakeDone_ is not set for
+      // rejected connection, so it's closed by the handshake timeout then.
+      if (!admitByKey(connection)) {
+         rejectHandshake(connection);
+         return false;
+      }
+      releaseIpSlot(connection);
+
       connection->outKeyTimePoint_ = std::chrono::steady_clock::now();
+      const auto latencyUs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+         connection->outKeyTimePoint_ - connection->handshakeStart_).count());
+      ++handshakeCompleted_;
+      handshakeLatencyTotalUs_ += latencyUs;
+      auto maxLatency = handshakeLatencyMaxUs_.load();
+      while (latencyUs > maxLatency && !handshakeLatencyMaxUs_.compare_exchange_weak(maxLatency, latencyUs)) {}
+
+      // Published before the callback, handshakeComplete() could be checked from it
+      connection->handshakeDone_ = true;
       connCb_(clientId, connection->details);
       logger_->info("[TransportBIP15xServer::processAEADHandshake] BIP 150 handshake"
          " with client complete - connection with {} is ready and fully secured"
@@ -360,6 +476,7 @@ bool TransportBIP15xServer::processAEADHandshake(const bip15x::Message &msgObj
 
 std::shared_ptr<BIP15xPerConnData> TransportBIP15xServer::GetConnection(const std::string &clientId)
 {
+   std::lock_guard<std::mutex> lock(connMapMutex_);
    auto it = socketConnMap_.find(clientId);
    if (it == socketConnMap_.end()) {
       return nullptr;
@@ -369,8 +486,25 @@ std::shared_ptr<BIP15xPerConnData> TransportBIP15xServer::GetConnection(const st
 
 bool TransportBIP15xServer::sendData(const std::string &clientId, const std::string &data)
 {
-   BIP151Connection* connPtr = nullptr;
+   if (cryptoWorkers_.empty()) {
+      return sendDataImpl(clientId, data);
+   }
+
+   // Result is not known until the worker encrypts the packet, report only obvious failures
+   auto connection = GetConnection(clientId);
+   if (!connection || !connection->isValid) {
+      logger_->error("[TransportBIP15xServer::sendData] can't send {} bytes to "
+         "disconnected/invalid connection {}", data.size(), bs::toHex(clientId));
+      return false;
+   }
+   return postToCryptoWorker(clientId, [this, clientId, data]() mutable {
+      sendDataImpl(clientId, data, &data);
+   });
+}
 
+bool TransportBIP15xServer::sendDataImpl(const std::string &clientId, const std::string &data
+   , std::string *ownedData)
+{
    auto connection = GetConnection(clientId);
    if (!connection || !connection->isValid) {
       logger_->error("[TransportBIP15xServer::sendData] can't send {} bytes to "
@@ -378,6 +512,56 @@ bool TransportBIP15xServer::sendData(const std::string &clientId, const std::str
       return false;
    }
 
+   ++messageCount_;
+   std::lock_guard<std::mutex> lock(connection->sendMutex_);
+
+   if (connection->chunking_ && (data.size() > bip15x::ChunkSize)) {
+      // Keep messages order
+      if (!flushBatch(connection)) {
+         return false;
+      }
+      return sendChunked(connection, data);
+   }
+
+   if (connection->batching_) {
+      const auto now = std::chrono::steady_clock::now();
+      if (connection->batch_.empty()) {
+         if (now - connection->lastRecordTime_ >= kBatchDeadline) {
+            connection->lastRecordTime_ = now;
+            return encryptAndSend(connection, reinterpret_cast<const uint8_t*>(data.data())
+               , data.size(), ArmoryAEAD::BIP151_PayloadType::SinglePacket);
+         }
+         connection->batchDeadline_ = now + kBatchDeadline;
+         scheduleBatchFlush(connection);
+      }
+      if (ownedData) {
+         connection->batch_.add(std::move(*ownedData));
+      } else {
+         connection->batch_.add(data);
+      }
+      if (connection->batch_.size() >= kBatchMaxSize) {
+         return flushBatch(connection);
+      }
+      return true;
+   }
+
+   return encryptAndSend(connection, reinterpret_cast<const uint8_t*>(data.data()), data.size()
+      , ArmoryAEAD::BIP151_PayloadType::SinglePacket);
+}
+
+bool TransportBIP15xServer::encryptAndSend(const std::shared_ptr<BIP15xPerConnData> &connection
+   , const uint8_t *data, size_t size, ArmoryAEAD::BIP151_PayloadType type)
+{
+   return encryptAndSend(connection, {}, data, size, type);
+}
+
+bool TransportBIP15xServer::encryptAndSend(const std::shared_ptr<BIP15xPerConnData> &connection
+   , const std::string &prefix, const uint8_t *data, size_t size
+   , ArmoryAEAD::BIP151_PayloadType type)
+{
+   BIP151Connection* connPtr = nullptr;
+   const auto &clientId = connection->clientId;
+
    if (connection->encData_->connectionComplete()) {
       connPtr = connection->encData_.get();
    }
@@ -388,7 +572,7 @@ bool TransportBIP15xServer::sendData(const std::string &clientId, const std::str
       auto rightNow = std::chrono::steady_clock::now();
 
       // Rekey off # of bytes sent or length of time since last rekey.
-      if (connPtr->rekeyNeeded(data.size())) {
+      if (connPtr->rekeyNeeded(prefix.size() + size)) {
          needsRekey = true;
       }
       else {
@@ -407,25 +591,174 @@ bool TransportBIP15xServer::sendData(const std::string &clientId, const std::str
 
    // Encrypt data here if the BIP 150 handshake is complete.
    if (connection->encData_ && connection->encData_->getBIP150State() == BIP150State::SUCCESS) {
-      const auto &packet = bip15x::MessageBuilder(BinaryData::fromString(data)
-         , ArmoryAEAD::BIP151_PayloadType::SinglePacket).encryptIfNeeded(connPtr).build();
-      return sendDataCb_(clientId, packet.toBinStr());
+      bip15x::MessageBuilder::buildInto(connection->sendBuffer_, prefix, data
+         , static_cast<uint32_t>(size), type, connPtr);
+      ++recordCount_;
+      return sendDataCb_(clientId, connection->sendBuffer_);
    }
 
    logger_->error("[TransportBIP15xServer::sendData] tried to send unencrypted data");
    throw std::runtime_error("trying to send unencrypted data");
 }
 
+bool TransportBIP15xServer::flushBatch(const std::shared_ptr<BIP15xPerConnData> &connection)
+{
+   auto &batch = connection->batch_;
+   if (batch.empty()) {
+      return true;
+   }
+
+   bool result = false;
+   if (batch.count() == 1) {
+      // No need to pay for batch framing
+      const auto &msg = batch.front();
+      result = encryptAndSend(connection, reinterpret_cast<const uint8_t*>(msg.data()), msg.size()
+         , ArmoryAEAD::BIP151_PayloadType::SinglePacket);
+   } else {
+      batch.serialize(connection->batchBuffer_);
+      result = encryptAndSend(connection, reinterpret_cast<const uint8_t*>(connection->batchBuffer_.data())
+         , connection->batchBuffer_.size()
+         , static_cast<ArmoryAEAD::BIP151_PayloadType>(bip15x::BatchedPacketType));
+   }
+   batch.clear();
+   connection->lastRecordTime_ = std::chrono::steady_clock::now();
+   return result;
+}
+
+bool TransportBIP15xServer::sendChunked(const std::shared_ptr<BIP15xPerConnData> &connection
+   , const std::string &data)
+{
+   // Only one chunk is encrypted at a time
+   const auto ptr = reinterpret_cast<const uint8_t*>(data.data());
+   for (size_t offset = 0; offset < data.size(); offset += bip15x::ChunkSize) {
+      const auto chunkSize = std::min(bip15x::ChunkSize, data.size() - offset);
+      const auto header = bip15x::MessageBuilder::chunkHeader(offset == 0, data.size());
+      if (!encryptAndSend(connection, header, ptr + offset, chunkSize
+         , static_cast<ArmoryAEAD::BIP151_PayloadType>(bip15x::ChunkedPacketType))) {
+         return false;
+      }
+   }
+   return true;
+}
+
+void TransportBIP15xServer::scheduleBatchFlush(const std::shared_ptr<BIP15xPerConnData> &connection)
+{
+   {
+      std::lock_guard<std::mutex> lock(batchFlushMutex_);
+      if (batchFlushStop_) {
+         return;
+      }
+      if (!batchFlushThread_.joinable()) {
+         batchFlushThread_ = std::thread(&TransportBIP15xServer::batchFlushFunction, this);
+      }
+      batchFlushQueue_.emplace_back(connection->batchDeadline_, connection);
+   }
+   batchFlushCv_.notify_one();
+}
+
+void TransportBIP15xServer::batchFlushFunction()
+{
+   bs::setCurrentThreadName("BIP15xBatch");
+
+   std::unique_lock<std::mutex> lock(batchFlushMutex_);
+   while (!batchFlushStop_) {
+      if (batchFlushQueue_.empty()) {
+         batchFlushCv_.wait(lock);
+         continue;
+      }
+
+      // Deadline is the same for all, so the queue is sorted
+      const auto deadline = batchFlushQueue_.front().first;
+      if (std::chrono::steady_clock::now() < deadline) {
+         batchFlushCv_.wait_until(lock, deadline);
+         continue;
+      }
+
+      auto connection = batchFlushQueue_.front().second.lock();
+      batchFlushQueue_.pop_front();
+      if (!connection) {
+         continue;
+      }
+
+      lock.unlock();
+      {
+         std::lock_guard<std::mutex> sendLock(connection->sendMutex_);
+         // Batch could be already sent because of size limit, and the new one is not due yet
+         if (!connection->batch_.empty()
+            && (connection->batchDeadline_ <= std::chrono::steady_clock::now())) {
+            try {
+               flushBatch(connection);
+            } catch (const std::exception &e) {
+               SPDLOG_LOGGER_ERROR(logger_, "batch flush failed: {}", e.what());
+            }
+         }
+      }
+      lock.lock();
+   }
+}
+
+void TransportBIP15xServer::stopBatchFlush()
+{
+   {
+      std::lock_guard<std::mutex> lock(batchFlushMutex_);
+      batchFlushStop_ = true;
+   }
+   batchFlushCv_.notify_one();
+   if (batchFlushThread_.joinable()) {
+      batchFlushThread_.join();
+   }
+}
+
+BIP15xBatchStats TransportBIP15xServer::batchStats() const
+{
+   BIP15xBatchStats result;
+   result.messageCount = messageCount_;
+   result.recordCount = recordCount_;
+   return result;
+}
+
 void TransportBIP15xServer::closeClient(const std::string &clientId)
 {
-   auto it = socketConnMap_.find(clientId);
-   if (it == socketConnMap_.end()) {
+   if (postToCryptoWorker(clientId, [this, clientId] {
+      closeClientImpl(clientId);
+   })) {
+      return;
+   }
+   closeClientImpl(clientId);
+}
+
+void TransportBIP15xServer::flushPendingBatch(const std::shared_ptr<BIP15xPerConnData> &connection)
+{
+   std::lock_guard<std::mutex> sendLock(connection->sendMutex_);
+   try {
+      flushBatch(connection);
+   } catch (const std::exception &e) {
+      SPDLOG_LOGGER_ERROR(logger_, "batch flush failed: {}", e.what());
+   }
+}
+
+void TransportBIP15xServer::closeClientImpl(const std::string &clientId)
+{
+   auto connection = GetConnection(clientId);
+   if (!connection) {
       SPDLOG_LOGGER_ERROR(logger_, "connection {} not found", bs::toHex(clientId));
       return;
    }
+   // Replies sent right before closing are still in the batch. It's flushed while
+   // the connection is in the map, as rekey looks it up there.
+   flushPendingBatch(connection);
+   {
+      std::lock_guard<std::mutex> lock(connMapMutex_);
+      auto it = socketConnMap_.find(clientId);
+      if ((it == socketConnMap_.end()) || (it->second != connection)) {
+         return;  // already closed
+      }
+      socketConnMap_.erase(it);
+   }
+   releaseIpSlot(connection);
 
-   const bool wasConnected = handshakeCompleted(it->second->encData_.get());
-   socketConnMap_.erase(it);
+   // Connection rejected after BIP 150 was completed was never reported as connected
+   const bool wasConnected = connection->handshakeDone_;
 
    SPDLOG_LOGGER_DEBUG(logger_, "connection {} erased, wasConnected: {}", bs::toHex(clientId), wasConnected);
 
@@ -441,28 +774,289 @@ void TransportBIP15xServer::closeClient(const std::string &clientId)
 // OUTPUT: None
 // RETURN: new or existing connection
 void TransportBIP15xServer::addClient(const std::string &clientId, const ServerConnectionListener::Details &details)
+{
+   if (postToCryptoWorker(clientId, [this, clientId, details] {
+      addClientImpl(clientId, details);
+   })) {
+      return;
+   }
+   addClientImpl(clientId, details);
+}
+
+void TransportBIP15xServer::addClientImpl(const std::string &clientId, const ServerConnectionListener::Details &details)
 {
    SPDLOG_LOGGER_DEBUG(logger_, "adding new connection for client {}"
       , BinaryData::fromString(clientId).toHexStr());
-   auto &connection = socketConnMap_[clientId];
-   assert(!connection);
 
    bool oneWayAuth = (authMode_ == BIP15xAuthMode::OneWay) ? true : false;
 
    auto lbds = getAuthPeerLambda();
-   connection = std::make_shared<BIP15xPerConnData>();
+   auto connection = std::make_shared<BIP15xPerConnData>();
    connection->encData_ = std::make_unique<BIP151Connection>(lbds, oneWayAuth);
    connection->outKeyTimePoint_ = std::chrono::steady_clock::now();
+   connection->handshakeStart_ = connection->outKeyTimePoint_;
    connection->details = details;
    connection->clientId = clientId;
 
-   startHandshake(clientId);
+   {
+      std::lock_guard<std::mutex> lock(connMapMutex_);
+      auto &connRef = socketConnMap_[clientId];
+      assert(!connRef);
+      connRef = connection;
+   }
+
+   if (!admitByIp(connection)) {
+      return;
+   }
+
+   if (handshakeWorkers_.empty()) {
+      startHandshake(clientId);
+      return;
+   }
+   postHandshake(connection, [this, clientId] {
+      startHandshake(clientId);
+   });
+}
+
+void TransportBIP15xServer::setCryptoThreads(unsigned count)
+{
+   if (!cryptoWorkers_.empty()) {
+      SPDLOG_LOGGER_ERROR(logger_, "crypto workers are already started");
+      return;
+   }
+   startWorkers(cryptoWorkers_, count, "BIP15xCrypto");
+}
+
+void TransportBIP15xServer::setHandshakeThreads(unsigned count
+   , const BIP15xHandshakeParams &params)
+{
+   if (!handshakeWorkers_.empty()) {
+      SPDLOG_LOGGER_ERROR(logger_, "handshake workers are already started");
+      return;
+   }
+   handshakeParams_ = params;
+   startWorkers(handshakeWorkers_, count, "BIP15xHandshake");
+}
+
+bool TransportBIP15xServer::postToCryptoWorker(const std::string &clientId, std::function<void()> task)
+{
+   return postToWorker(cryptoWorkers_, clientId, std::move(task));
+}
+
+void TransportBIP15xServer::startWorkers(std::vector<std::unique_ptr<CryptoWorker>> &workers
+   , unsigned count, const std::string &name)
+{
+   for (unsigned i = 0; i < count; ++i) {
+      auto worker = std::make_unique<CryptoWorker>();
+      worker->thread = std::thread(&TransportBIP15xServer::workerFunction, this, worker.get(), name);
+      workers.push_back(std::move(worker));
+   }
+}
+
+bool TransportBIP15xServer::postToWorker(const std::vector<std::unique_ptr<CryptoWorker>> &workers
+   , const std::string &clientId, std::function<void()> task, bool *dropped)
+{
+   if (workers.empty()) {
+      return false;
+   }
+
+   // The same client always goes to the same worker, this keeps its packets ordered
+   auto &worker = workers[std::hash<std::string>()(clientId) % workers.size()];
+   {
+      std::lock_guard<std::mutex> lock(worker->mutex);
+      if (worker->stopped) {  // shutting down - task is dropped
+         if (dropped) {
+            *dropped = true;
+         }
+         return true;
+      }
+      worker->tasks.push_back(std::move(task));
+   }
+   worker->cv.notify_one();
+   return true;
+}
+
+void TransportBIP15xServer::workerFunction(CryptoWorker *worker, const std::string &name)
+{
+   bs::setCurrentThreadName(name);
+
+   while (true) {
+      std::deque<std::function<void()>> tasks;
+      {
+         std::unique_lock<std::mutex> lock(worker->mutex);
+         worker->cv.wait(lock, [worker] { return worker->stopped || !worker->tasks.empty(); });
+         if (worker->tasks.empty()) {
+            return;
+         }
+         tasks.swap(worker->tasks);
+      }
+
+      for (auto &task : tasks) {
+         try {
+            task();
+         } catch (const std::exception &e) {
+            SPDLOG_LOGGER_ERROR(logger_, "{} task failed: {}", name, e.what());
+         }
+      }
+   }
+}
+
+void TransportBIP15xServer::stopWorkers(std::vector<std::unique_ptr<CryptoWorker>> &workers)
+{
+   for (auto &worker : workers) {
+      {
+         std::lock_guard<std::mutex> lock(worker->mutex);
+         worker->stopped = true;
+      }
+      worker->cv.notify_one();
+   }
+   for (auto &worker : workers) {
+      if (worker->thread.joinable()) {
+         worker->thread.join();
+      }
+   }
+}
+
+bool TransportBIP15xServer::postHandshake(const std::shared_ptr<BIP15xPerConnData> &connection
+   , std::function<void()> task)
+{
+   // Established sessions never wait here, only new ones are rejected on overload
+   if (handshakeQueueDepth_ >= handshakeParams_.maxQueue) {
+      SPDLOG_LOGGER_ERROR(logger_, "handshake queue is full, reject {}", bs::toHex(connection->clientId));
+      rejectHandshake(connection);
+      return false;
+   }
+
+   const auto depth = ++handshakeQueueDepth_;
+   auto maxDepth = maxHandshakeQueueDepth_.load();
+   while (depth > maxDepth && !maxHandshakeQueueDepth_.compare_exchange_weak(maxDepth, depth)) {}
+
+   ++connection->handshakeTasks_;
+   bool dropped = false;
+   const bool posted = postToWorker(handshakeWorkers_, connection->clientId
+      , [this, connection, task = std::move(task)] {
+      try {
+         task();
+      } catch (...) {
+         --handshakeQueueDepth_;
+         --connection->handshakeTasks_;
+         throw;
+      }
+      --handshakeQueueDepth_;
+      --connection->handshakeTasks_;
+   }, &dropped);
+   if (!posted || dropped) {  // the task will never run
+      --handshakeQueueDepth_;
+      --connection->handshakeTasks_;
+      return false;
+   }
+   return true;
+}
+
+bool TransportBIP15xServer::admitByIp(const std::shared_ptr<BIP15xPerConnData> &connection)
+{
+   if (handshakeParams_.maxPerIp == 0) {
+      return true;
+   }
+   const auto itIp = connection->details.find(ServerConnectionListener::Detail::IpAddr);
+   if (itIp == connection->details.end()) {
+      return true;
+   }
+
+   {
+      std::lock_guard<std::mutex> lock(admissionMutex_);
+      auto &count = handshakesPerIp_[itIp->second];
+      if (count < handshakeParams_.maxPerIp) {
+         ++count;
+         connection->ipSlotTaken_ = true;
+         return true;
+      }
+   }
+
+   SPDLOG_LOGGER_ERROR(logger_, "too many handshakes from {}, reject {}"
+      , itIp->second, bs::toHex(connection->clientId));
+   rejectHandshake(connection);
+   return false;
+}
+
+bool TransportBIP15xServer::admitByKey(const std::shared_ptr<BIP15xPerConnData> &connection)
+{
+   if (handshakeParams_.maxPerKey == 0) {
+      return true;
+   }
+   // Not known for 1-way auth
+   const auto &peerKey = connection->encData_->getChosenAuthPeerKey();
+   if (peerKey.getSize() == 0) {
+      return true;
+   }
+
+   const auto rightNow = std::chrono::steady_clock::now();
+   std::lock_guard<std::mutex> lock(admissionMutex_);
+   auto &keyState = handshakesPerKey_[peerKey.toBinStr()];
+   if (rightNow - keyState.first >= handshakeParams_.perKeyWindow) {
+      keyState.first = rightNow;
+      keyState.second = 0;
+   }
+   if (keyState.second >= handshakeParams_.maxPerKey) {
+      SPDLOG_LOGGER_ERROR(logger_, "too many handshakes with key {}, reject {}"
+         , peerKey.toHexStr(), bs::toHex(connection->clientId));
+      return false;
+   }
+   ++keyState.second;
+
+   // Drop stale entries occasionally
+   if (handshakesPerKey_.size() > 4096) {
+      for (auto it = handshakesPerKey_.begin(); it != handshakesPerKey_.end(); ) {
+         if (rightNow - it->second.first >= handshakeParams_.perKeyWindow) {
+            it = handshakesPerKey_.erase(it);
+         } else {
+            ++it;
+         }
+      }
+   }
+   return true;
+}
+
+void TransportBIP15xServer::releaseIpSlot(const std::shared_ptr<BIP15xPerConnData> &connection)
+{
+   std::lock_guard<std::mutex> lock(admissionMutex_);
+   if (!connection->ipSlotTaken_) {
+      return;
+   }
+   connection->ipSlotTaken_ = false;
+
+   const auto itIp = connection->details.find(ServerConnectionListener::Detail::IpAddr);
+   auto itCount = handshakesPerIp_.find(itIp->second);
+   if ((itCount != handshakesPerIp_.end()) && (--itCount->second == 0)) {
+      handshakesPerIp_.erase(itCount);
+   }
+}
+
+void TransportBIP15xServer::rejectHandshake(const std::shared_ptr<BIP15xPerConnData> &connection)
+{
+   ++handshakeRejected_;
+   // Rejected connection should not hold a slot until it's closed
+   releaseIpSlot(connection);
+   // Connection is closed by the handshake timeout then (handshakeDone_ is not set)
+   reportFatalError(connection);
+}
+
+BIP15xHandshakeStats TransportBIP15xServer::handshakeStats() const
+{
+   BIP15xHandshakeStats result;
+   result.completedCount = handshakeCompleted_;
+   result.rejectedCount = handshakeRejected_;
+   result.queueDepth = handshakeQueueDepth_;
+   result.maxQueueDepth = maxHandshakeQueueDepth_;
+   result.avgLatencyUs = result.completedCount ? handshakeLatencyTotalUs_ / result.completedCount : 0;
+   result.maxLatencyUs = handshakeLatencyMaxUs_;
+   return result;
 }
 
 void TransportBIP15xServer::reportFatalError(const std::shared_ptr<BIP15xPerConnData> &conn)
 {
-   if (conn->isValid) {
-      conn->isValid = false;
+   // Error is reported once even if several threads fail at the same time
+   if (conn->isValid.exchange(false)) {
       clientErrorCb_(conn->clientId, ServerConnectionListener::HandshakeFailed, conn->details);
    }
 }
@@ -473,7 +1067,8 @@ bool TransportBIP15xServer::handshakeComplete(const std::string &clientId)
    if (!connection) {
       return false;
    }
-   return (connection->encData_->getBIP150State() == BIP150State::SUCCESS);
+   // Cipher state could be changed by a worker at the same time, so only atomic flag is checked here
+   return connection->handshakeDone_;
 }
 
 BIP15xServerParams TransportBIP15xServer::getParams(unsigned port) const
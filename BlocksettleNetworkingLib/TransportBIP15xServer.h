@@ -12,9 +12,12 @@
 #define __TRANSPORT_BIP15X_SERVER_H__
 
 #include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <functional>
 #include <mutex>
 #include <thread>
+#include <vector>
 #include <spdlog/spdlog.h>
 #include "AuthorizedPeers.h"
 #include "BIP15xHelpers.h"
@@ -46,9 +49,63 @@ namespace bs {
 
          std::unique_ptr<BIP151Connection> encData_;
          std::chrono::time_point<std::chrono::steady_clock> outKeyTimePoint_;
+         // Reused for encrypted data packets, accessed together with encData_ state
+         std::string sendBuffer_;
          ServerConnectionListener::Details details;
-         bool     isValid{ true };
+         // Cleared on fatal error, read from socket, crypto worker and batch flush threads
+         std::atomic_bool  isValid{ true };
          std::string clientId;
+
+         // Guards outgoing encryption and batch, as batches are flushed from own thread too
+         std::mutex  sendMutex_;
+         // Set when client announced batched/chunked packets support
+         bool        batching_{ false };
+         bool        chunking_{ false };
+         bip15x::MessageBatch batch_;
+         std::chrono::time_point<std::chrono::steady_clock> batchDeadline_;
+         std::chrono::time_point<std::chrono::steady_clock> lastRecordTime_;
+         std::string batchBuffer_;
+
+         // Handshake executor and admission control state
+         std::chrono::time_point<std::chrono::steady_clock> handshakeStart_;
+         std::atomic<unsigned> handshakeTasks_{ 0 };
+         // Set when handshake is completed and admitted, could be read from any thread
+         std::atomic<bool> handshakeDone_{ false };
+         bool        ipSlotTaken_{ false };
+
+         // Incoming path only
+         bip15x::ChunkAssembler chunkAssembler_;
+      };
+
+      struct BIP15xHandshakeStats
+      {
+         uint64_t completedCount{};
+         // Rejected by admission control or because of full handshake queue
+         uint64_t rejectedCount{};
+         uint64_t queueDepth{};
+         uint64_t maxQueueDepth{};
+         // Time from connection to completed handshake
+         uint64_t avgLatencyUs{};
+         uint64_t maxLatencyUs{};
+      };
+
+      struct BIP15xHandshakeParams
+      {
+         // Handshakes above that are rejected
+         size_t   maxQueue{ 1024 };
+         // Admission control, 0 disables the limit:
+         // concurrent handshakes from one IP address
+         unsigned maxPerIp{ 0 };
+         // completed handshakes with the same client key per perKeyWindow
+         unsigned maxPerKey{ 0 };
+         std::chrono::seconds perKeyWindow{ 60 };
+      };
+
+      struct BIP15xBatchStats
+      {
+         uint64_t messageCount{};
+         // AEAD records used to send these messages
+         uint64_t recordCount{};
       };
 
       struct BIP15xServerParams
@@ -115,7 +172,29 @@ namespace bs {
          bool handshakeComplete(const std::string &clientId) override;
          BIP15xServerParams getParams(unsigned) const;
 
+         // Optional: run AEAD (handshake, encryption, decryption and rekeys) on a pool
+         // of worker threads instead of the caller's thread. Connections are sharded
+         // by client ID, so packets of each client are still processed in order and
+         // its cipher state is used by a single thread only.
+         // Callbacks are invoked from the worker threads then.
+         // Must be called before accepting connections. 0 (default) disables the pool.
+         void setCryptoThreads(unsigned count);
+
+         // Records-per-message ratio is recordCount / messageCount
+         BIP15xBatchStats batchStats() const;
+
+         // Optional: run BIP 150/151 handshakes (ECDH and authentication) on dedicated
+         // threads, so reconnect storms do not stall established sessions.
+         // Must be called before accepting connections.
+         void setHandshakeThreads(unsigned count, const BIP15xHandshakeParams &params = {});
+
+         BIP15xHandshakeStats handshakeStats() const;
+
+         // Incoming chunked messages above that size are rejected (connection is closed)
+         void setMaxChunkedMessageSize(uint64_t size) { maxChunkedMessageSize_ = size; }
+
       private:
+         struct CryptoWorker;
          bool createCookie(void);
          bool rmCookieFile(void);
          bool usesCookie(void) const override;
@@ -125,20 +204,93 @@ namespace bs {
 
          void processIncomingData(const std::string &encData
             , const std::string &clientID) override;
+         void processIncomingDataImpl(const std::string &encData
+            , const std::string &clientID, bool onHandshakeThread = false);
          bool processAEADHandshake(const bip15x::Message &
             , const std::string &clientID);
 
          std::shared_ptr<BIP15xPerConnData> GetConnection(const std::string& clientId);
 
          bool sendData(const std::string &clientId, const std::string &) override;
+         // If ownedData is set (it's the same string as data), it's moved to the batch instead of copying
+         bool sendDataImpl(const std::string &clientId, const std::string &data
+            , std::string *ownedData = nullptr);
 
          void closeClient(const std::string &clientId) override;
+         void closeClientImpl(const std::string &clientId);
          void addClient(const std::string &clientId, const ServerConnectionListener::Details &details) override;
+         void addClientImpl(const std::string &clientId, const ServerConnectionListener::Details &details);
+
+         // Returns false if worker pool is not used and task should be done in place
+         bool postToCryptoWorker(const std::string &clientId, std::function<void()> task);
+         void startWorkers(std::vector<std::unique_ptr<CryptoWorker>> &workers
+            , unsigned count, const std::string &name);
+         // dropped is set if the worker is stopped and the task won't run
+         bool postToWorker(const std::vector<std::unique_ptr<CryptoWorker>> &workers
+            , const std::string &clientId, std::function<void()> task, bool *dropped = nullptr);
+         void workerFunction(CryptoWorker *worker, const std::string &name);
+         void stopWorkers(std::vector<std::unique_ptr<CryptoWorker>> &workers);
+
+         // Returns false if handshake queue is full (connection is failed then)
+         // or handshake workers are stopped
+         bool postHandshake(const std::shared_ptr<BIP15xPerConnData> &connection
+            , std::function<void()> task);
+         bool admitByIp(const std::shared_ptr<BIP15xPerConnData> &connection);
+         bool admitByKey(const std::shared_ptr<BIP15xPerConnData> &connection);
+         void releaseIpSlot(const std::shared_ptr<BIP15xPerConnData> &connection);
+         void rejectHandshake(const std::shared_ptr<BIP15xPerConnData> &connection);
+
+         // Must be called with connection->sendMutex_ locked
+         bool encryptAndSend(const std::shared_ptr<BIP15xPerConnData> &connection
+            , const uint8_t *data, size_t size, ArmoryAEAD::BIP151_PayloadType type);
+         bool encryptAndSend(const std::shared_ptr<BIP15xPerConnData> &connection
+            , const std::string &prefix, const uint8_t *data, size_t size
+            , ArmoryAEAD::BIP151_PayloadType type);
+         bool flushBatch(const std::shared_ptr<BIP15xPerConnData> &connection);
+         bool sendChunked(const std::shared_ptr<BIP15xPerConnData> &connection
+            , const std::string &data);
+         void scheduleBatchFlush(const std::shared_ptr<BIP15xPerConnData> &connection);
+         void batchFlushFunction();
+         void stopBatchFlush();
+         // Locks connection->sendMutex_ and sends queued batch if any
+         void flushPendingBatch(const std::shared_ptr<BIP15xPerConnData> &connection);
 
          void reportFatalError(const std::shared_ptr<BIP15xPerConnData> &conn);
 
       private:
          std::map<std::string, std::shared_ptr<BIP15xPerConnData>>   socketConnMap_;
+         // Guards socketConnMap_ (but not its items) when worker pool is used
+         mutable std::mutex connMapMutex_;
+
+         std::vector<std::unique_ptr<CryptoWorker>> cryptoWorkers_;
+
+         std::vector<std::unique_ptr<CryptoWorker>> handshakeWorkers_;
+         BIP15xHandshakeParams      handshakeParams_;
+         std::atomic<uint64_t>      handshakeQueueDepth_{ 0 };
+         std::atomic<uint64_t>      maxHandshakeQueueDepth_{ 0 };
+         std::atomic<uint64_t>      handshakeCompleted_{ 0 };
+         std::atomic<uint64_t>      handshakeRejected_{ 0 };
+         std::atomic<uint64_t>      handshakeLatencyTotalUs_{ 0 };
+         std::atomic<uint64_t>      handshakeLatencyMaxUs_{ 0 };
+
+         std::mutex                 admissionMutex_;
+         // Handshakes in progress per IP address
+         std::map<std::string, unsigned>  handshakesPerIp_;
+         // Completed handshakes per client key in the current window
+         std::map<std::string, std::pair<std::chrono::time_point<std::chrono::steady_clock>, unsigned>> handshakesPerKey_;
+
+         // Started on first batching connection, flushes batches on deadline
+         std::thread                batchFlushThread_;
+         std::mutex                 batchFlushMutex_;
+         std::condition_variable    batchFlushCv_;
+         std::deque<std::pair<std::chrono::time_point<std::chrono::steady_clock>
+            , std::weak_ptr<BIP15xPerConnData>>>   batchFlushQueue_;
+         bool                       batchFlushStop_{ false };
+
+         std::atomic<uint64_t>      maxChunkedMessageSize_{ bip15x::DefaultMaxChunkedMessageSize };
+
+         std::atomic<uint64_t>      messageCount_{ 0 };
+         std::atomic<uint64_t>      recordCount_{ 0 };
          
          const bool ephemeralPeers_;
          const BIP15xAuthMode authMode_;
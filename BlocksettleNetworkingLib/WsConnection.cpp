@@ -90,6 +90,11 @@ uint8_t *WsRawPacket::getPtr()
    return data_.data() + kLwsPrePaddingSize;
 }
 
+const uint8_t *WsRawPacket::getPtr() const
+{
+   return data_.data() + kLwsPrePaddingSize;
+}
+
 size_t WsRawPacket::getSize() const
 {
    return data_.size() - kLwsPrePaddingSize;
@@ -146,6 +151,11 @@ WsRawPacket WsPacket::ack(uint64_t recvCounter)
 }
 
 WsPacket WsPacket::parsePacket(const std::string &data, const std::shared_ptr<spdlog::logger> &logger)
+{
+   return parsePacket(std::string(data), logger);
+}
+
+WsPacket WsPacket::parsePacket(std::string &&data, const std::shared_ptr<spdlog::logger> &logger)
 {
    try {
       WsPacket result;
@@ -171,11 +181,14 @@ WsPacket WsPacket::parsePacket(const std::string &data, const std::shared_ptr<sp
          case Type::ResponseNew:
          case Type::Data: {
             auto payloadSize = r.get_var_int();
-            if (r.getSizeRemaining() < payloadSize) {
+            if (r.getSizeRemaining() != payloadSize) {
                throw std::runtime_error("invalid packet");
             }
-            result.payload = r.get_String(static_cast<uint32_t>(payloadSize));
-            break;
+            // Payload is always the tail of the frame, so strip the header
+            // and reuse the frame buffer instead of allocating a new string
+            data.erase(0, data.size() - static_cast<size_t>(payloadSize));
+            result.payload = std::move(data);
+            return result;
          }
          default:
             break;
@@ -68,6 +68,7 @@ namespace bs {
          explicit WsRawPacket(const std::string &data);
 
          uint8_t *getPtr();
+         const uint8_t *getPtr() const;
 
          size_t getSize() const;
       };
@@ -109,6 +110,10 @@ namespace bs {
 
          static WsPacket parsePacket(const std::string &payload
             , const std::shared_ptr<spdlog::logger> &logger);
+
+         // Takes ownership of the frame buffer and moves it into WsPacket::payload
+         static WsPacket parsePacket(std::string &&payload
+            , const std::shared_ptr<spdlog::logger> &logger);
       };
 
    }
@@ -231,12 +231,17 @@ int WsDataConnection::callback(lws *wsi, int reason, void *user, void *in, size_
          }
 
          auto ptr = static_cast<const char*>(in);
+         const auto remaining = lws_remaining_packet_payload(wsi);
+         if (currFragment_.empty() && len + remaining <= params_.maximumPacketSize) {
+            // Reserve whole frame at once, the buffer is handed over to the listener later
+            currFragment_.reserve(len + remaining);
+         }
          currFragment_.insert(currFragment_.end(), ptr, ptr + len);
          if (currFragment_.size() > params_.maximumPacketSize) {
             SPDLOG_LOGGER_ERROR(logger_, "maximum packet size reached");
             return -1;
          }
-         if (lws_remaining_packet_payload(wsi) > 0) {
+         if (remaining > 0) {
             return 0;
          }
          if (!lws_is_final_fragment(wsi)) {
@@ -245,7 +250,7 @@ int WsDataConnection::callback(lws *wsi, int reason, void *user, void *in, size_
             return -1;
          }
 
-         auto packet = WsPacket::parsePacket(currFragment_, logger_);
+         auto packet = WsPacket::parsePacket(std::move(currFragment_), logger_);
          currFragment_.clear();
 
          switch (state_) {
@@ -301,7 +306,7 @@ int WsDataConnection::callback(lws *wsi, int reason, void *user, void *in, size_
                      break;
                   }
                   case WsPacket::Type::Data: {
-                     listener_->OnDataReceived(packet.payload);
+                     listener_->OnDataReceivedOwned(std::move(packet.payload));
                      recvCounter_ += 1;
                      break;
                   }
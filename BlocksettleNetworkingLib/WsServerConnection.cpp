@@ -14,6 +14,7 @@
 #include "EncryptionUtils.h"
 #include "StringUtils.h"
 #include "ThreadName.h"
+#include "WsSessionStore.h"
 
 #include <random>
 #include <libwebsockets.h>
@@ -87,6 +88,16 @@ bool WsServerConnection::BindConnection(const std::string& host , const std::str
    shuttingDown_ = false;
    listener_ = listener;
 
+   if (!params_.sessionStoreFileName.empty() && !sessionRestoreDisabled_) {
+      try {
+         sessionStore_ = std::make_unique<ws::WsSessionStore>(logger_, params_.sessionStoreFileName);
+         restoreSessions();
+      } catch (const std::exception &e) {
+         SPDLOG_LOGGER_ERROR(logger_, "opening session store failed: {}", e.what());
+         sessionStore_.reset();
+      }
+   }
+
    listenThread_ = std::thread(&WsServerConnection::listenFunction, this);
 
    return true;
@@ -98,6 +109,11 @@ void WsServerConnection::listenFunction()
 
    while (!done()) {
       lws_service(context_, 0);
+
+      // All changes made during one service iteration are committed at once
+      if (sessionStore_) {
+         sessionStore_->flush();
+      }
    }
 }
 
@@ -122,6 +138,7 @@ void WsServerConnection::stopServer()
    cookieToClientIdMap_ = {};
    shuttingDownReceived_ = {};
    timers_.clear();
+   sessionStore_.reset();
 }
 
 int WsServerConnection::callback(lws *wsi, int reason, void *in, size_t len)
@@ -142,8 +159,13 @@ int WsServerConnection::callback(lws *wsi, int reason, void *in, size_t len)
             if (data.clientId == kAllClientsId) {
                for (auto &item : clients_) {
                   auto &client = item.second;
+                  if (sessionStore_) {
+                     sessionStore_->addPacket(client.cookie, client.queuedCounter, std::string(
+                        reinterpret_cast<const char*>(data.packet.getPtr()), data.packet.getSize()));
+                  }
                   client.allPackets.insert(std::make_pair(client.queuedCounter, data.packet));
                   client.queuedCounter += 1;
+                  storeClient(item.first, client);
                   requestWriteIfNeeded(client);
                }
                continue;
@@ -154,8 +176,13 @@ int WsServerConnection::callback(lws *wsi, int reason, void *in, size_t len)
                continue;
             }
             auto &client = clientIt->second;
+            if (sessionStore_) {
+               sessionStore_->addPacket(client.cookie, client.queuedCounter, std::string(
+                  reinterpret_cast<const char*>(data.packet.getPtr()), data.packet.getSize()));
+            }
             client.allPackets.insert(std::make_pair(client.queuedCounter, data.packet));
             client.queuedCounter += 1;
+            storeClient(clientIt->first, client);
             requestWriteIfNeeded(client);
          }
 
@@ -226,23 +253,10 @@ int WsServerConnection::callback(lws *wsi, int reason, void *in, size_t len)
          switch (connection.state) {
             case State::Connected:
             case State::SendingHandshakeResumed: {
-               const auto &clientId = connection.clientId;
                auto &client = clients_.at(connection.clientId);
                SPDLOG_LOGGER_DEBUG(logger_, "connection closed unexpectedly, clientId: {}", bs::toHex(connection.clientId));
                client.wsi = nullptr;
-               timers_.scheduleCallback(context_, params_.clientTimeout, [this, clientId] {
-                  auto clientIt = clients_.find(clientId);
-                  if (clientIt == clients_.end()) {
-                     return;
-                  }
-                  auto &client = clientIt->second;
-                  if (client.wsi == nullptr) {
-                     SPDLOG_LOGGER_ERROR(logger_, "connection removed by timeout");
-                     closeConnectedClient(clientId);
-                     listener_->OnClientDisconnected(clientId);
-                     listener_->onClientError(clientId, ServerConnectionListener::Timeout, {});
-                  }
-               });
+               scheduleClientTimeout(connection.clientId);
                break;
             }
             case State::SendingHandshakeNew:
@@ -261,13 +275,18 @@ int WsServerConnection::callback(lws *wsi, int reason, void *in, size_t len)
          auto &connection = connections_.at(wsi);
 
          auto ptr = static_cast<const char*>(in);
+         const auto remaining = lws_remaining_packet_payload(wsi);
+         if (connection.currFragment.empty() && len + remaining <= params_.maximumPacketSize) {
+            // Reserve whole frame at once, the buffer is handed over to the listener later
+            connection.currFragment.reserve(len + remaining);
+         }
          connection.currFragment.insert(connection.currFragment.end(), ptr, ptr + len);
          if (connection.currFragment.size() > params_.maximumPacketSize) {
             SPDLOG_LOGGER_ERROR(logger_, "maximum packet size reached");
             processError(wsi);
             return -1;
          }
-         if (lws_remaining_packet_payload(wsi) > 0) {
+         if (remaining > 0) {
             return 0;
          }
          if (!lws_is_final_fragment(wsi)) {
@@ -276,7 +295,7 @@ int WsServerConnection::callback(lws *wsi, int reason, void *in, size_t len)
             return -1;
          }
 
-         auto packet = WsPacket::parsePacket(connection.currFragment, logger_);
+         auto packet = WsPacket::parsePacket(std::move(connection.currFragment), logger_);
          connection.currFragment.clear();
 
          switch (connection.state) {
@@ -285,7 +304,8 @@ int WsServerConnection::callback(lws *wsi, int reason, void *in, size_t len)
                switch (packet.type) {
                   case WsPacket::Type::Data: {
                      client.recvCounter += 1;
-                     listener_->OnDataFromClient(connection.clientId, packet.payload);
+                     storeClient(connection.clientId, client);
+                     listener_->OnDataFromClientOwned(connection.clientId, std::move(packet.payload));
                      break;
                   }
                   case WsPacket::Type::Ack: {
@@ -294,6 +314,7 @@ int WsServerConnection::callback(lws *wsi, int reason, void *in, size_t len)
                         processError(wsi);
                         return -1;
                      }
+                     storeClient(connection.clientId, client);
                      break;
                   }
                   default: {
@@ -327,6 +348,7 @@ int WsServerConnection::callback(lws *wsi, int reason, void *in, size_t len)
                         processError(wsi);
                         return -1;
                      }
+                     storeClient(clientId, client);
                      if (client.wsi != nullptr) {
                         auto &oldConnection = connections_.at(client.wsi);
                         oldConnection.state = State::Closed;
@@ -422,6 +444,16 @@ int WsServerConnection::callback(lws *wsi, int reason, void *in, size_t len)
                connection.state = State::Connected;
                lws_callback_on_writable(wsi);
                SPDLOG_LOGGER_DEBUG(logger_, "session resumed for client {}", bs::toHex(connection.clientId));
+               if (client.ipAddr != connection.ipAddr) {
+                  client.ipAddr = connection.ipAddr;
+                  storeClient(connection.clientId, client);
+               }
+               if (client.restored) {
+                  client.restored = false;
+                  ServerConnectionListener::Details details;
+                  details[ServerConnectionListener::Detail::IpAddr] = connection.ipAddr;
+                  listener_->OnClientConnected(connection.clientId, details);
+               }
                return 0;
             }
             case State::SendingHandshakeNew: {
@@ -439,6 +471,8 @@ int WsServerConnection::callback(lws *wsi, int reason, void *in, size_t len)
                auto &client = clients_[clientId];
                client.cookie = cookie;
                client.wsi = wsi;
+               client.ipAddr = connection.ipAddr;
+               storeClient(clientId, client);
                connection.clientId = clientId;
                ServerConnectionListener::Details details;
                details[ServerConnectionListener::Detail::IpAddr] = connection.ipAddr;
@@ -484,9 +518,22 @@ int WsServerConnection::callback(lws *wsi, int reason, void *in, size_t len)
 
 std::string WsServerConnection::nextClientId()
 {
-   nextClientId_ += 1;
-   auto ptr = reinterpret_cast<char*>(&nextClientId_);
-   return std::string(ptr, ptr + sizeof(nextClientId_));
+   std::string clientId;
+   do {  // restored sessions keep their old (random) ids
+      nextClientId_ += 1;
+      auto ptr = reinterpret_cast<char*>(&nextClientId_);
+      clientId.assign(ptr, ptr + sizeof(nextClientId_));
+   } while (clients_.find(clientId) != clients_.end());
+   return clientId;
+}
+
+void WsServerConnection::disableSessionRestore()
+{
+   if (!params_.sessionStoreFileName.empty() && !sessionRestoreDisabled_) {
+      SPDLOG_LOGGER_WARN(logger_, "session store {} is ignored, sessions could not be restored through wrapping transport"
+         , params_.sessionStoreFileName);
+   }
+   sessionRestoreDisabled_ = true;
 }
 
 bool WsServerConnection::done() const
@@ -516,6 +563,10 @@ bool WsServerConnection::processSentAck(WsServerConnection::ClientData &client,
       return false;
    }
 
+   if (sessionStore_ && client.sentAckCounter < sentAckCounter) {
+      sessionStore_->removePackets(client.cookie, client.sentAckCounter, sentAckCounter);
+   }
+
    while (client.sentAckCounter < sentAckCounter) {
       size_t count = client.allPackets.erase(client.sentAckCounter);
       assert(count == 1);
@@ -549,9 +600,76 @@ void WsServerConnection::closeConnectedClient(const std::string &clientId)
    auto &client = clients_.at(clientId);
    auto count = cookieToClientIdMap_.erase(client.cookie);
    assert(count == 1);
+   if (sessionStore_) {
+      sessionStore_->removeSession(client.cookie, client.sentAckCounter, client.queuedCounter);
+   }
    clients_.erase(clientId);
 }
 
+void WsServerConnection::scheduleClientTimeout(const std::string &clientId)
+{
+   timers_.scheduleCallback(context_, params_.clientTimeout, [this, clientId] {
+      auto clientIt = clients_.find(clientId);
+      if (clientIt == clients_.end()) {
+         return;
+      }
+      auto &client = clientIt->second;
+      if (client.wsi == nullptr) {
+         SPDLOG_LOGGER_ERROR(logger_, "connection removed by timeout");
+         const bool restored = client.restored;
+         closeConnectedClient(clientId);
+         if (!restored) {
+            listener_->OnClientDisconnected(clientId);
+            listener_->onClientError(clientId, ServerConnectionListener::Timeout, {});
+         }
+      }
+   });
+}
+
+void WsServerConnection::restoreSessions()
+{
+   auto sessions = sessionStore_->load();
+   for (auto &session : sessions) {
+      if (clients_.find(session.clientId) != clients_.end()) {
+         SPDLOG_LOGGER_ERROR(logger_, "duplicated clientId in session store: {}", bs::toHex(session.clientId));
+         sessionStore_->removeSession(session.cookie, session.sentAckCounter, session.queuedCounter);
+         continue;
+      }
+      auto &client = clients_[session.clientId];
+      client.cookie = session.cookie;
+      client.ipAddr = session.ipAddr;
+      client.sentAckCounter = session.sentAckCounter;
+      client.queuedCounter = session.queuedCounter;
+      // Everything queued could be already sent, resume handshake will rewind it
+      client.sentCounter = session.queuedCounter;
+      client.recvCounter = session.recvCounter;
+      client.recvAckCounter = session.recvCounter;
+      client.restored = true;
+      for (const auto &packet : session.packets) {
+         client.allPackets.insert(std::make_pair(packet.first, WsRawPacket(packet.second)));
+      }
+      cookieToClientIdMap_[session.cookie] = session.clientId;
+      scheduleClientTimeout(session.clientId);
+   }
+   sessionStore_->flush();
+   SPDLOG_LOGGER_INFO(logger_, "{} WS sessions restored", sessions.size());
+}
+
+void WsServerConnection::storeClient(const std::string &clientId, const ClientData &client)
+{
+   if (!sessionStore_) {
+      return;
+   }
+   ws::WsStoredSession session;
+   session.cookie = client.cookie;
+   session.clientId = clientId;
+   session.ipAddr = client.ipAddr;
+   session.sentAckCounter = client.sentAckCounter;
+   session.queuedCounter = client.queuedCounter;
+   session.recvCounter = client.recvCounter;
+   sessionStore_->updateSession(session);
+}
+
 bool WsServerConnection::SendDataToClient(const std::string &clientId, const std::string &data)
 {
    DataToSend toSend{clientId, WsPacket::data(data)};
@@ -33,6 +33,9 @@ struct lws_sorted_usec_list;
 namespace bs {
    namespace network {
       struct WsPacket;
+      namespace ws {
+         class WsSessionStore;
+      }
    }
 }
 
@@ -51,6 +54,13 @@ struct WsServerConnectionParams
    std::chrono::milliseconds handshakeTimeout{std::chrono::seconds(5)};
 
    std::chrono::milliseconds clientTimeout{std::chrono::seconds(30)};
+
+   // If set, resume state (cookies, counters and not acked packets) is saved to this LMDB file.
+   // Sessions loaded on BindConnection could be resumed by clients after server restart
+   // (OnClientConnected is reported when such client reconnects).
+   // Not resumed sessions are dropped after clientTimeout.
+   // Ignored when wrapped by Bip15xServerConnection (cipher state is not persisted).
+   std::string sessionStoreFileName;
 };
 
 class WsServerConnection : public ServerConnection
@@ -70,6 +80,8 @@ public:
    bool SendDataToClient(const std::string& clientId, const std::string& data) override;
    bool SendDataToAllClients(const std::string&) override;
 
+   void disableSessionRestore() override;
+
    bool timer(std::chrono::milliseconds timeout, TimerCallback callback) override;
 
    bool closeClient(const std::string& clientId) override;
@@ -111,6 +123,9 @@ private:
       uint64_t queuedCounter{};
       uint64_t recvCounter{};
       uint64_t recvAckCounter{};
+      std::string ipAddr;
+      // Loaded from session store and not yet reported to the listener
+      bool restored{};
    };
 
    void listenFunction();
@@ -128,9 +143,14 @@ private:
    bool processSentAck(ClientData &client, uint64_t sentAckCounter);
    void processError(lws *wsi);
    void closeConnectedClient(const std::string &clientId);
+   void scheduleClientTimeout(const std::string &clientId);
+   void restoreSessions();
+   void storeClient(const std::string &clientId, const ClientData &client);
 
    std::shared_ptr<spdlog::logger>  logger_;
    const WsServerConnectionParams params_;
+   // Set before BindConnection by wrapping transport, params_.sessionStoreFileName is ignored then
+   bool sessionRestoreDisabled_{};
 
    std::thread listenThread_;
    ServerConnectionListener *listener_{};
@@ -148,6 +168,7 @@ private:
    uint64_t nextClientId_{};
    bool shuttingDownReceived_{};
    bs::network::ws::WsTimerHelper timers_;
+   std::unique_ptr<bs::network::ws::WsSessionStore> sessionStore_;
 
 };
 
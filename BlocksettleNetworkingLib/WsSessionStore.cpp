@@ -0,0 +1,198 @@
+/*
+
+***********************************************************************************
+* Copyright (C) 2021, BlockSettle AB
+* Distributed under the GNU Affero General Public License (AGPL v3)
+* See LICENSE or http://www.gnu.org/licenses/agpl.html
+*
+**********************************************************************************
+
+*/
+#include "WsSessionStore.h"
+
+#include <lmdbpp.h>
+#include <spdlog/spdlog.h>
+
+#include "BinaryData.h"
+
+using namespace bs::network::ws;
+
+namespace {
+
+   // Resend windows could be large, LMDB map is sparse so only used pages take disk space.
+   // From LMDB docs: The size should be a multiple of the OS page size
+   const size_t kSessionStoreMapSize = 256 * 1024 * 1024;
+
+   const uint8_t kSessionPrefix = 0xE1;
+   const uint8_t kPacketPrefix = 0xE2;
+
+   std::string sessionKey(const std::string &cookie)
+   {
+      BinaryWriter w;
+      w.put_uint8_t(kSessionPrefix);
+      w.put_String(cookie);
+      return w.toString();
+   }
+
+   std::string packetKey(const std::string &cookie, uint64_t counter)
+   {
+      BinaryWriter w;
+      w.put_uint8_t(kPacketPrefix);
+      w.put_var_int(cookie.size());
+      w.put_String(cookie);
+      w.put_uint64_t(counter);
+      return w.toString();
+   }
+
+} // namespace
+
+WsSessionStore::WsSessionStore(const std::shared_ptr<spdlog::logger> &logger, const std::string &filename)
+   : logger_(logger)
+{
+   dbEnv_ = std::make_shared<LMDBEnv>();
+   dbEnv_->open(filename);
+   dbEnv_->setMapSize(kSessionStoreMapSize);
+   db_ = std::make_unique<LMDB>(dbEnv_.get(), "ws_sessions");
+}
+
+WsSessionStore::~WsSessionStore()
+{
+   flush();
+   db_->close();
+   dbEnv_->close();
+}
+
+std::vector<WsStoredSession> WsSessionStore::load()
+{
+   std::map<std::string, WsStoredSession> sessions;
+   std::map<std::string, std::map<uint64_t, std::string>> packets;
+
+   {
+      LMDBEnv::Transaction tx(dbEnv_.get(), LMDB::ReadOnly);
+      auto dbIter = db_->begin();
+
+      BinaryWriter bwKey;
+      bwKey.put_uint8_t(kSessionPrefix);
+      CharacterArrayRef keyRef(bwKey.getSize(), bwKey.getData().getPtr());
+      dbIter.seek(keyRef, LMDB::Iterator::Seek_GE);
+
+      while (dbIter.isValid()) {
+         auto iterkey = dbIter.key();
+         auto itervalue = dbIter.value();
+         BinaryRefReader brrKey(reinterpret_cast<const uint8_t*>(iterkey.mv_data), iterkey.mv_size);
+         BinaryRefReader brrVal(reinterpret_cast<const uint8_t*>(itervalue.mv_data), itervalue.mv_size);
+
+         try {
+            const auto prefix = brrKey.get_uint8_t();
+            if (prefix == kSessionPrefix) {
+               WsStoredSession session;
+               session.cookie = brrKey.get_String(static_cast<uint32_t>(brrKey.getSizeRemaining()));
+               session.clientId = brrVal.get_String(static_cast<uint32_t>(brrVal.get_var_int()));
+               session.ipAddr = brrVal.get_String(static_cast<uint32_t>(brrVal.get_var_int()));
+               session.sentAckCounter = brrVal.get_var_int();
+               session.queuedCounter = brrVal.get_var_int();
+               session.recvCounter = brrVal.get_var_int();
+               sessions[session.cookie] = std::move(session);
+            } else if (prefix == kPacketPrefix) {
+               const auto cookie = brrKey.get_String(static_cast<uint32_t>(brrKey.get_var_int()));
+               const auto counter = brrKey.get_uint64_t();
+               packets[cookie][counter] = brrVal.get_String(static_cast<uint32_t>(brrVal.getSizeRemaining()));
+            } else {
+               break;
+            }
+         } catch (const std::exception &e) {
+            SPDLOG_LOGGER_ERROR(logger_, "skip invalid WS session record: {}", e.what());
+         }
+
+         dbIter.advance();
+      }
+   }
+
+   std::vector<WsStoredSession> result;
+   for (auto &item : sessions) {
+      auto &session = item.second;
+      auto &sessionPackets = packets[session.cookie];
+      bool valid = session.sentAckCounter <= session.queuedCounter;
+      for (uint64_t counter = session.sentAckCounter; valid && counter < session.queuedCounter; ++counter) {
+         valid = sessionPackets.find(counter) != sessionPackets.end();
+      }
+      if (!valid) {
+         SPDLOG_LOGGER_ERROR(logger_, "WS session {} has incomplete resend window, drop it"
+            , BinaryData::fromString(session.clientId).toHexStr());
+         removeSession(session.cookie, session.sentAckCounter, session.queuedCounter);
+         continue;
+      }
+      session.packets = std::move(sessionPackets);
+      result.push_back(std::move(session));
+   }
+   flush();
+
+   SPDLOG_LOGGER_DEBUG(logger_, "{} WS sessions loaded", result.size());
+   return result;
+}
+
+void WsSessionStore::updateSession(const WsStoredSession &session)
+{
+   BinaryWriter w;
+   w.put_var_int(session.clientId.size());
+   w.put_String(session.clientId);
+   w.put_var_int(session.ipAddr.size());
+   w.put_String(session.ipAddr);
+   w.put_var_int(session.sentAckCounter);
+   w.put_var_int(session.queuedCounter);
+   w.put_var_int(session.recvCounter);
+   put(sessionKey(session.cookie), w.toString());
+}
+
+void WsSessionStore::addPacket(const std::string &cookie, uint64_t counter, const std::string &rawPacket)
+{
+   put(packetKey(cookie, counter), rawPacket);
+}
+
+void WsSessionStore::removePackets(const std::string &cookie, uint64_t from, uint64_t to)
+{
+   for (auto counter = from; counter < to; ++counter) {
+      erase(packetKey(cookie, counter));
+   }
+}
+
+void WsSessionStore::removeSession(const std::string &cookie, uint64_t sentAckCounter, uint64_t queuedCounter)
+{
+   removePackets(cookie, sentAckCounter, queuedCounter);
+   erase(sessionKey(cookie));
+}
+
+void WsSessionStore::flush()
+{
+   if (pendingPuts_.empty() && pendingErases_.empty()) {
+      return;
+   }
+
+   try {
+      LMDBEnv::Transaction tx(dbEnv_.get(), LMDB::ReadWrite);
+      for (const auto &key : pendingErases_) {
+         db_->erase(CharacterArrayRef(key.size(), key.data()));
+      }
+      for (const auto &item : pendingPuts_) {
+         db_->insert(CharacterArrayRef(item.first.size(), item.first.data())
+            , CharacterArrayRef(item.second.size(), item.second.data()));
+      }
+   } catch (const std::exception &e) {
+      SPDLOG_LOGGER_ERROR(logger_, "saving WS sessions failed: {}", e.what());
+   }
+
+   pendingPuts_.clear();
+   pendingErases_.clear();
+}
+
+void WsSessionStore::put(std::string key, std::string value)
+{
+   pendingErases_.erase(key);
+   pendingPuts_[std::move(key)] = std::move(value);
+}
+
+void WsSessionStore::erase(std::string key)
+{
+   pendingPuts_.erase(key);
+   pendingErases_.insert(std::move(key));
+}
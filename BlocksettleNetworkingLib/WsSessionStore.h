@@ -0,0 +1,89 @@
+/*
+
+***********************************************************************************
+* Copyright (C) 2021, BlockSettle AB
+* Distributed under the GNU Affero General Public License (AGPL v3)
+* See LICENSE or http://www.gnu.org/licenses/agpl.html
+*
+**********************************************************************************
+
+*/
+#ifndef WS_SESSION_STORE_H
+#define WS_SESSION_STORE_H
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace spdlog {
+   class logger;
+}
+
+class LMDB;
+class LMDBEnv;
+
+namespace bs {
+   namespace network {
+      namespace ws {
+
+         struct WsStoredSession
+         {
+            std::string cookie;
+            std::string clientId;
+            std::string ipAddr;
+            uint64_t sentAckCounter{};
+            uint64_t queuedCounter{};
+            uint64_t recvCounter{};
+
+            // Raw packets not yet acked by the client (sentAckCounter..queuedCounter)
+            std::map<uint64_t, std::string> packets;
+         };
+
+         // Keeps WS resume state (cookie -> counters and resend window) in LMDB (memory-mapped file),
+         // so sessions could be resumed after server restart.
+         // Changes are accumulated in memory and committed in a single transaction by flush().
+         // Not thread-safe, should be used from the server's listening thread only.
+         // Only WS level state is kept: transports on top of it (BIP15x) lose their cipher state on restart,
+         // so WsServerConnection doesn't use the store when wrapped by Bip15xServerConnection.
+         class WsSessionStore
+         {
+         public:
+            WsSessionStore(const std::shared_ptr<spdlog::logger> &logger, const std::string &filename);
+            ~WsSessionStore();
+
+            WsSessionStore(const WsSessionStore&) = delete;
+            WsSessionStore& operator = (const WsSessionStore&) = delete;
+            WsSessionStore(WsSessionStore&&) = delete;
+            WsSessionStore& operator = (WsSessionStore&&) = delete;
+
+            std::vector<WsStoredSession> load();
+
+            // Packets field is ignored here, use addPacket/removePackets
+            void updateSession(const WsStoredSession &session);
+            void addPacket(const std::string &cookie, uint64_t counter, const std::string &rawPacket);
+            // Removes packets in [from, to) range
+            void removePackets(const std::string &cookie, uint64_t from, uint64_t to);
+            void removeSession(const std::string &cookie, uint64_t sentAckCounter, uint64_t queuedCounter);
+
+            void flush();
+
+         private:
+            void put(std::string key, std::string value);
+            void erase(std::string key);
+
+            std::shared_ptr<spdlog::logger> logger_;
+            std::shared_ptr<LMDBEnv> dbEnv_;
+            std::unique_ptr<LMDB> db_;
+
+            std::map<std::string, std::string> pendingPuts_;
+            std::set<std::string> pendingErases_;
+         };
+
+      }
+   }
+}
+
+#endif // WS_SESSION_STORE_H
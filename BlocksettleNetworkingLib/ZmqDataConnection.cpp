@@ -294,7 +294,7 @@ void ZmqDataConnection::listenFunction()
                tmpBuf = std::move(sendQueue_);
                sendQueue_.clear();
             }
-            for (const auto &sendBuf : tmpBuf) {
+            for (auto &sendBuf : tmpBuf) {
                int result = zmq_send(dataSocket_.get(), socketId_.c_str(), socketId_.size(), ZMQ_SNDMORE);
                if (result != (int)socketId_.size()) {
                   if (logger_) {
@@ -304,8 +304,9 @@ void ZmqDataConnection::listenFunction()
                   continue;
                }
 
-               result = zmq_send(dataSocket_.get(), sendBuf.data(), sendBuf.size(), ZMQ_SNDMORE);
-               if (result != (int)sendBuf.size()) {
+               const auto bufSize = sendBuf.size();
+               result = bs::network::sendFrame(dataSocket_.get(), std::move(sendBuf), ZMQ_SNDMORE);
+               if (result != (int)bufSize) {
                   if (logger_) {
                      logger_->error("[{}] {} failed to send data frame {}"
                         , __func__, connectionName_, zmq_strerror(zmq_errno()));
@@ -449,6 +450,11 @@ bool ZmqDataConnection::closeConnection()
 }
 
 bool ZmqDataConnection::sendRawData(const std::string& rawData)
+{
+   return sendRawData(std::string(rawData));
+}
+
+bool ZmqDataConnection::sendRawData(std::string&& rawData)
 {
    if (!isActive()) {
       if (logger_) {
@@ -459,7 +465,7 @@ bool ZmqDataConnection::sendRawData(const std::string& rawData)
 
    {
       FastLock locker(lockFlag_);
-      sendQueue_.push_back(rawData);
+      sendQueue_.push_back(std::move(rawData));
    }
 
    int command = ZmqDataConnection::CommandSend;
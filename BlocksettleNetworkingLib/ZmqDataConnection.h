@@ -52,6 +52,8 @@ public:
 
 protected:
    bool sendRawData(const std::string& rawData);
+   // Data buffer is moved through the queue to ZMQ without copying
+   bool sendRawData(std::string&& rawData);
 
    virtual bool recvData();
 
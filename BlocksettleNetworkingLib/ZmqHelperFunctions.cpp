@@ -89,3 +89,14 @@ std::string bs::network::peerAddressString(int socket)
       return "";
    }
 }
+
+int bs::network::sendFrame(void *socket, std::string &&data, int flags)
+{
+   // Below that size allocating zmq_msg_t content costs more than memcpy
+   constexpr size_t kZeroCopyMinSize = 4096;
+   if (data.size() < kZeroCopyMinSize) {
+      return zmq_send(socket, data.data(), data.size(), flags);
+   }
+   MessageHolder msg(std::move(data));
+   return zmq_msg_send(&msg, socket, flags);
+}
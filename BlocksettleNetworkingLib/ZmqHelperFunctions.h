@@ -20,6 +20,11 @@ namespace bs
       int get_monitor_event(void *monitor);
       int get_monitor_event(void *monitor, int *value);
       std::string peerAddressString(int socket);
+
+      // Sends single frame. Large buffers are handed over to ZMQ without copying
+      // (data is moved out), small ones are copied as it's cheaper.
+      // Returns the same as zmq_send.
+      int sendFrame(void *socket, std::string &&data, int flags);
    }
 }
 
@@ -15,6 +15,10 @@
 #include "MessageHolder.h"
 #include "ThreadName.h"
 
+#include <algorithm>
+#include <iterator>
+#include <unordered_map>
+
 #include <spdlog/spdlog.h>
 #include <zmq.h>
 
@@ -23,6 +27,10 @@ namespace
 
    const std::chrono::seconds kHearthbeatCheckPeriod(1);
 
+   // Packets blocked by HWM are retried with this period, client is dropped if still blocked after timeout
+   const std::chrono::milliseconds kSendRetryPeriod(10);
+   const std::chrono::seconds kSendRetryTimeout(5);
+
 } // namespace
 
 ZmqServerConnection::ZmqServerConnection(
@@ -178,7 +186,8 @@ void ZmqServerConnection::listenFunction()
    int errorCount = 0;
 
    while (true) {
-      int periodMs = std::chrono::duration_cast<std::chrono::milliseconds>(kHearthbeatCheckPeriod).count();
+      int periodMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+         retryQueue_.empty() ? kHearthbeatCheckPeriod : kSendRetryPeriod).count();
       int result = zmq_poll(poll_items, pollSize, periodMs);
 
       if (result == -1) {
@@ -195,6 +204,7 @@ void ZmqServerConnection::listenFunction()
 
       errorCount = 0;
 
+      bool sendDone = false;
       if (poll_items[ZmqServerConnection::ControlSocketIndex].revents & ZMQ_POLLIN) {
          MessageHolder   command;
 
@@ -208,6 +218,7 @@ void ZmqServerConnection::listenFunction()
          auto command_code = command.ToInt();
          if (command_code == ZmqServerConnection::CommandSend) {
             SendDataToDataSocket();
+            sendDone = true;
          } else if (command_code == ZmqServerConnection::CommandStop) {
             break;
          } else {
@@ -225,6 +236,10 @@ void ZmqServerConnection::listenFunction()
          }
       }
 
+      if (!sendDone && !retryQueue_.empty()) {
+         SendDataToDataSocket();
+      }
+
       onPeriodicCheck();
    }
 
@@ -269,6 +284,18 @@ std::thread::id ZmqServerConnection::listenThreadId() const
    return listenThread_.get_id();
 }
 
+bool ZmqServerConnection::SendDataCommandIfNeeded()
+{
+   if (sendCommandPending_.exchange(true)) {
+      return true;
+   }
+   if (!SendDataCommand()) {
+      sendCommandPending_ = false;
+      return false;
+   }
+   return true;
+}
+
 bool ZmqServerConnection::SendDataCommand()
 {
    int command = ZmqServerConnection::CommandSend;
@@ -325,7 +352,46 @@ bool ZmqServerConnection::QueueDataToSend(const std::string& clientId, const std
       dataQueue_.emplace_back( DataToSend{clientId, data, sendMore});
    }
 
-   return SendDataCommand();
+   return SendDataCommandIfNeeded();
+}
+
+bool ZmqServerConnection::QueueDataToSend(const std::string& clientId, std::string&& data
+   , bool sendMore)
+{
+   {
+      FastLock locker{dataQueueLock_};
+      dataQueue_.emplace_back( DataToSend{clientId, std::move(data), sendMore});
+   }
+
+   return SendDataCommandIfNeeded();
+}
+
+bool ZmqServerConnection::QueueDataToSend(DataBatch &&batch, bool sendMore)
+{
+   if (batch.empty()) {
+      return true;
+   }
+
+   {
+      FastLock locker{dataQueueLock_};
+      for (auto &item : batch) {
+         dataQueue_.emplace_back(DataToSend{std::move(item.first), std::move(item.second), sendMore});
+      }
+   }
+   batch.clear();
+
+   return SendDataCommandIfNeeded();
+}
+
+ZmqServerSendStats ZmqServerConnection::sendStats() const
+{
+   ZmqServerSendStats result;
+   result.sentCount = sentCount_;
+   result.hwmDropCount = hwmDropCount_;
+   result.hwmRetryCount = hwmRetryCount_;
+   result.errorCount = sendErrorCount_;
+   result.sendCommandCount = sendCommandCount_;
+   return result;
 }
 
 void ZmqServerConnection::onPeriodicCheck()
@@ -334,28 +400,128 @@ void ZmqServerConnection::onPeriodicCheck()
 
 void ZmqServerConnection::SendDataToDataSocket()
 {
+   sendCommandCount_++;
+
+   // Packets waiting for retry go first to keep per client order
    decltype(dataQueue_) pendingData;
+   pendingData.swap(retryQueue_);
 
+   // Drain everything queued so far in one pass.
+   // Reset pending flag before taking the queue, so data queued after the swap will wake us again.
+   sendCommandPending_ = false;
    {
       FastLock locker{dataQueueLock_};
-      pendingData.swap(dataQueue_);
+      if (pendingData.empty()) {
+         pendingData.swap(dataQueue_);
+      } else {
+         std::move(dataQueue_.begin(), dataQueue_.end(), std::back_inserter(pendingData));
+         dataQueue_.clear();
+      }
    }
 
-   for (const auto &dataPacket : pendingData) {
-      int result = zmq_send(dataSocket_.get(), dataPacket.clientId.c_str(), dataPacket.clientId.size(), ZMQ_SNDMORE);
-      if (result != dataPacket.clientId.size()) {
-         logger_->error("[{}] {} failed to send client id {}", __func__
-            , connectionName_, zmq_strerror(zmq_errno()));
+   uint64_t sentCount = 0;
+   uint64_t hwmDropCount = 0;
+   uint64_t hwmRetryCount = 0;
+   uint64_t errorCount = 0;
+   const auto now = std::chrono::steady_clock::now();
+   std::vector<std::string> failedClients;
+   // Once client is blocked in this pass all its following packets wait too.
+   // Value is set for failed clients - their packets are dropped below.
+   std::unordered_map<std::string, bool> blockedClients;
+   const auto putAside = [this, &hwmRetryCount](DataToSend &dataPacket) {
+      if (!dataPacket.delayed) {
+         dataPacket.delayed = true;
+         ++hwmRetryCount;
+      }
+      retryQueue_.push_back(std::move(dataPacket));
+   };
+
+   for (auto &dataPacket : pendingData) {
+      const auto itBlocked = blockedClients.find(dataPacket.clientId);
+      if (itBlocked != blockedClients.end()) {
+         if (itBlocked->second) {
+            retryQueue_.push_back(std::move(dataPacket));
+         } else {
+            putAside(dataPacket);
+         }
          continue;
       }
 
-      result = zmq_send(dataSocket_.get(), dataPacket.data.data(), dataPacket.data.size(), (dataPacket.sendMore ? ZMQ_SNDMORE : 0));
-      if (result != dataPacket.data.size()) {
-         logger_->error("[{}] {} failed to send data frame {} to {}", __func__
-            , connectionName_, zmq_strerror(zmq_errno()), dataPacket.clientId);
-         continue;
+      switch (sendPacket(dataPacket)) {
+      case SendResult::Sent:
+         ++sentCount;
+         blockedSince_.erase(dataPacket.clientId);
+         break;
+      case SendResult::Blocked: {
+         const auto itBlocked = blockedSince_.emplace(dataPacket.clientId, now).first;
+         if (now - itBlocked->second >= kSendRetryTimeout) {
+            failedClients.push_back(dataPacket.clientId);
+            blockedClients[dataPacket.clientId] = true;
+            ++hwmDropCount;
+            break;
+         }
+         blockedClients[dataPacket.clientId] = false;
+         putAside(dataPacket);
+         break;
+      }
+      case SendResult::Failed:
+         ++errorCount;
+         failedClients.push_back(dataPacket.clientId);
+         blockedClients[dataPacket.clientId] = true;
+         break;
       }
    }
+
+   for (const auto &clientId : failedClients) {
+      hwmDropCount += dropRetryPackets(clientId);
+      blockedSince_.erase(clientId);
+      onSendFailed(clientId);
+   }
+
+   sentCount_ += sentCount;
+   hwmDropCount_ += hwmDropCount;
+   hwmRetryCount_ += hwmRetryCount;
+   sendErrorCount_ += errorCount;
+   if (hwmDropCount != 0) {
+      logger_->warn("[{}] {} dropped {} messages because of HWM", __func__
+         , connectionName_, hwmDropCount);
+   }
+}
+
+ZmqServerConnection::SendResult ZmqServerConnection::sendPacket(DataToSend &dataPacket)
+{
+   // Do not block listen thread (up to ZMQ_SNDTIMEO) on slow peers.
+   // ROUTER and STREAM sockets check peer's HWM on identity frame only, so EAGAIN here leaves nothing queued.
+   int result = zmq_send(dataSocket_.get(), dataPacket.clientId.c_str(), dataPacket.clientId.size(), ZMQ_SNDMORE | ZMQ_DONTWAIT);
+   if (result != dataPacket.clientId.size()) {
+      if (zmq_errno() == EAGAIN) {
+         return SendResult::Blocked;
+      }
+      logger_->error("[{}] {} failed to send client id {}", __func__
+         , connectionName_, zmq_strerror(zmq_errno()));
+      return SendResult::Failed;
+   }
+
+   // Multipart message is started and must be completed, so data frame is sent without ZMQ_DONTWAIT
+   const auto dataSize = dataPacket.data.size();
+   result = bs::network::sendFrame(dataSocket_.get(), std::move(dataPacket.data)
+      , (dataPacket.sendMore ? ZMQ_SNDMORE : 0));
+   if (result != dataSize) {
+      logger_->error("[{}] {} failed to send data frame {} to {}", __func__
+         , connectionName_, zmq_strerror(zmq_errno()), dataPacket.clientId);
+      return SendResult::Failed;
+   }
+   return SendResult::Sent;
+}
+
+size_t ZmqServerConnection::dropRetryPackets(const std::string &clientId)
+{
+   const auto it = std::remove_if(retryQueue_.begin(), retryQueue_.end(), [&clientId](const DataToSend &packet) {
+      return (packet.clientId == clientId);
+   });
+   const auto count = std::distance(it, retryQueue_.end());
+   retryQueue_.erase(it, retryQueue_.end());
+   return count;
 }
 
 bool ZmqServerConnection::SetZMQTransport(ZMQTransport transport)
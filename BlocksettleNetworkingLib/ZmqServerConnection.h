@@ -15,6 +15,7 @@
 #include "ZmqContext.h"
 
 #include <atomic>
+#include <chrono>
 #include <deque>
 #include <thread>
 #include <unordered_map>
@@ -25,9 +26,23 @@ namespace spdlog
    class logger;
 }
 
+struct ZmqServerSendStats
+{
+   uint64_t sentCount{};
+   // Messages dropped because peer stayed at HWM (EAGAIN) for too long
+   uint64_t hwmDropCount{};
+   // Messages delayed at least once because their client was at HWM
+   uint64_t hwmRetryCount{};
+   uint64_t errorCount{};
+   // Number of listen thread wakeups used to send data
+   uint64_t sendCommandCount{};
+};
+
 class ZmqServerConnection : public ServerConnection
 {
 public:
+   using DataBatch = std::vector<std::pair<std::string, std::string>>;
+
    ZmqServerConnection(const std::shared_ptr<spdlog::logger>& logger
       , const std::shared_ptr<ZmqContext>& context);
 
@@ -54,6 +69,8 @@ public:
 
    void setThreadName(const std::string &name);
 
+   ZmqServerSendStats sendStats() const;
+
 protected:
    bool isActive() const;
 
@@ -72,7 +89,14 @@ protected:
 
    virtual void onPeriodicCheck();
 
+   // Called on listen thread when messages for the client were lost (send error or HWM timeout)
+   virtual void onSendFailed(const std::string& /*clientId*/) {}
+
    virtual bool QueueDataToSend(const std::string& clientId, const std::string& data, bool sendMore);
+   // Data buffer is moved through the queue to ZMQ without copying
+   virtual bool QueueDataToSend(const std::string& clientId, std::string&& data, bool sendMore);
+   // Queues all (clientId, data) pairs with a single wakeup of the listen thread
+   virtual bool QueueDataToSend(DataBatch &&batch, bool sendMore);
 
    std::shared_ptr<spdlog::logger>  logger_;
    std::shared_ptr<ZmqContext>      context_;
@@ -106,10 +130,20 @@ private:
       std::string    clientId;
       std::string    data;
       bool           sendMore;
+      bool           delayed{ false };   // already counted in hwmRetryCount_
+   };
+
+   enum class SendResult {
+      Sent,
+      Blocked,    // nothing was queued to socket, could be retried
+      Failed
    };
 
    bool SendDataCommand();
+   bool SendDataCommandIfNeeded();
    void SendDataToDataSocket();
+   SendResult sendPacket(DataToSend &);
+   size_t dropRetryPackets(const std::string &clientId);
 
    std::thread                      listenThread_;
    std::atomic_flag                 controlSocketLockFlag_ = ATOMIC_FLAG_INIT;
@@ -118,6 +152,16 @@ private:
    ServerConnectionListener*        listener_{nullptr};
    std::atomic_flag                 dataQueueLock_ = ATOMIC_FLAG_INIT;
    std::deque<DataToSend>           dataQueue_;
+   // Set when CommandSend is in flight, so producers do not wake listen thread again
+   std::atomic_bool                 sendCommandPending_{ false };
+   std::atomic<uint64_t>            sentCount_{};
+   std::atomic<uint64_t>            hwmDropCount_{};
+   std::atomic<uint64_t>            hwmRetryCount_{};
+   // Listen thread only: packets of clients at HWM (kept in order) and when each client got blocked
+   std::deque<DataToSend>           retryQueue_;
+   std::unordered_map<std::string, std::chrono::steady_clock::time_point> blockedSince_;
+   std::atomic<uint64_t>            sendErrorCount_{};
+   std::atomic<uint64_t>            sendCommandCount_{};
    ZMQTransport                     zmqTransport_ = ZMQTransport::TCPTransport;
    bool        immediate_{ false };
    std::string identity_;
@@ -59,6 +59,25 @@ bool ZmqStreamServerConnection::ReadFromDataSocket()
    return true;
 }
 
+void ZmqStreamServerConnection::onSendFailed(const std::string& clientId)
+{
+   // Stream can't continue after lost bytes (BIP15x ciphers would get out of sync), so the client is closed.
+   // Zero length frame closes the peer connection, no disconnect frame is received for it then.
+   if (zmq_send(dataSocket_.get(), clientId.data(), clientId.size(), ZMQ_SNDMORE) == static_cast<int>(clientId.size())) {
+      zmq_send(dataSocket_.get(), nullptr, 0, 0);
+   }
+
+   {
+      FastLock locker(connectionsLockFlag_);
+      if (activeConnections_.erase(clientId) == 0) {
+         return;
+      }
+   }
+   logger_->error("[ZmqStreamServerConnection::onSendFailed] {} closing client {} after failed send"
+      , connectionName_, clientId);
+   notifyListenerOnDisconnectedClient(clientId);
+}
+
 void ZmqStreamServerConnection::onZeroFrame(const std::string& clientId)
 {
    bool clientConnected = false;
@@ -113,6 +132,30 @@ bool ZmqStreamServerConnection::sendRawData(const std::string& clientId, const s
    return true;
 }
 
+bool ZmqStreamServerConnection::sendRawData(const std::string& clientId, std::string&& rawData)
+{
+   if (!isActive()) {
+      logger_->error("[ZmqStreamServerConnection::sendRawData] cound not send. not connected");
+      return false;
+   }
+
+   QueueDataToSend(clientId, std::move(rawData), true);
+
+   return true;
+}
+
+bool ZmqStreamServerConnection::sendRawData(DataBatch &&batch)
+{
+   if (!isActive()) {
+      logger_->error("[ZmqStreamServerConnection::sendRawData] cound not send. not connected");
+      return false;
+   }
+
+   QueueDataToSend(std::move(batch), true);
+
+   return true;
+}
+
 bool ZmqStreamServerConnection::SendDataToClient(const std::string& clientId, const std::string& data)
 {
    auto connection = findConnection(clientId);
@@ -128,16 +171,27 @@ bool ZmqStreamServerConnection::SendDataToClient(const std::string& clientId, co
 
 bool ZmqStreamServerConnection::SendDataToAllClients(const std::string& data)
 {
-   unsigned int successCount = 0;
+   std::vector<std::pair<std::string, server_connection_ptr>> connections;
+   {
+      FastLock locker(connectionsLockFlag_);
+      connections.assign(activeConnections_.cbegin(), activeConnections_.cend());
+   }
 
-   FastLock locker(connectionsLockFlag_);
-   for (auto & it : activeConnections_) {
-      const bool result = it.second->send(data);
-      if (result) {
-         successCount++;
+   bool result = true;
+   DataBatch batch;
+   batch.reserve(connections.size());
+   for (const auto &connection : connections) {
+      std::string rawData;
+      if (connection.second->frameData(data, rawData)) {
+         batch.emplace_back(connection.first, std::move(rawData));
+      } else if (!connection.second->send(data)) {
+         result = false;
       }
    }
-   return (successCount == activeConnections_.size());
+   if (!batch.empty() && !sendRawData(std::move(batch))) {
+      result = false;
+   }
+   return result;
 }
 
 ZmqStreamServerConnection::server_connection_ptr
@@ -41,13 +41,21 @@ public:
    ZmqStreamServerConnection& operator = (ZmqStreamServerConnection&&) = delete;
 
    bool SendDataToClient(const std::string& clientId, const std::string& data) override;
+   // Framed data for all clients is queued at once with a single wakeup of the listen thread
    bool SendDataToAllClients(const std::string& data) override;
+
+   // (clientId, raw data) pairs are queued with a single wakeup of the listen thread
+   bool sendRawData(DataBatch &&batch);
+
 protected:
    ZmqContext::sock_ptr CreateDataSocket() override;
 
    bool ReadFromDataSocket() override;
 
+   void onSendFailed(const std::string& clientId) override;
+
    bool sendRawData(const std::string& clientId, const std::string& rawData);
+   bool sendRawData(const std::string& clientId, std::string&& rawData);
 
    virtual server_connection_ptr CreateActiveConnection() = 0;
 
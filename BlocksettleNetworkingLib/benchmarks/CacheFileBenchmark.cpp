@@ -0,0 +1,195 @@
+/*
+
+***********************************************************************************
+* Copyright (C) 2021, BlockSettle AB
+* Distributed under the GNU Affero General Public License (AGPL v3)
+* See LICENSE or http://www.gnu.org/licenses/agpl.html
+*
+**********************************************************************************
+
+*/
+
+// In-process CacheFile throughput benchmark (built with -DBUILD_BENCHMARKS=ON).
+// For each shard count and thread count puts --ops values from all threads at once,
+// then reads them back in random order. Reports put and get operations per second
+// as JSON array on stdout. Cache is in-memory unless --file is given (LMDB file is
+// created next to it for each run and removed afterwards).
+//
+// Usage: cachefile_benchmark [--shards 1,16] [--threads 1,4,8] [--keys 100000]
+//    [--ops 1000000] [--value-size 256] [--file /tmp/cache_bench]
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "CacheFile.h"
+
+using json = nlohmann::json;
+
+namespace {
+
+   struct Options
+   {
+      std::vector<size_t> shards{ 1, 16 };
+      std::vector<size_t> threads{ 1, 4, 8 };
+      size_t keys{ 100000 };
+      size_t ops{ 1000000 };
+      size_t valueSize{ 256 };
+      std::string file;
+   };
+
+   std::vector<size_t> splitNumbers(const std::string &value)
+   {
+      std::vector<size_t> result;
+      std::stringstream ss(value);
+      std::string item;
+      while (std::getline(ss, item, ',')) {
+         if (!item.empty()) {
+            result.push_back(std::stoul(item));
+         }
+      }
+      return result;
+   }
+
+   bool parseOptions(int argc, char **argv, Options &options)
+   {
+      for (int i = 1; i < argc; ++i) {
+         const std::string arg = argv[i];
+         if (i + 1 >= argc) {
+            return false;
+         }
+         const std::string value = argv[++i];
+         if (arg == "--shards") {
+            options.shards = splitNumbers(value);
+         } else if (arg == "--threads") {
+            options.threads = splitNumbers(value);
+         } else if (arg == "--keys") {
+            options.keys = std::stoul(value);
+         } else if (arg == "--ops") {
+            options.ops = std::stoul(value);
+         } else if (arg == "--value-size") {
+            options.valueSize = std::stoul(value);
+         } else if (arg == "--file") {
+            options.file = value;
+         } else {
+            return false;
+         }
+      }
+      return (options.keys > 0);
+   }
+
+   // 32-byte keys, like TX hashes
+   std::vector<BinaryData> makeKeys(size_t count)
+   {
+      std::vector<BinaryData> result;
+      result.reserve(count);
+      for (size_t i = 0; i < count; ++i) {
+         auto key = std::to_string(i);
+         key.resize(32, '#');
+         result.push_back(BinaryData::fromString(key));
+      }
+      return result;
+   }
+
+   // Runs op(threadIndex, opIndex) for ops split evenly between threads started at once,
+   // returns operations per second
+   template<typename Op>
+   double runThreads(size_t threadsCount, size_t ops, const Op &op)
+   {
+      std::atomic_bool go{ false };
+      std::vector<std::thread> threads;
+      for (size_t t = 0; t < threadsCount; ++t) {
+         threads.emplace_back([&go, &op, t, threadsCount, ops] {
+            while (!go) {
+               std::this_thread::yield();
+            }
+            for (size_t i = t; i < ops; i += threadsCount) {
+               op(t, i);
+            }
+         });
+      }
+      const auto start = std::chrono::steady_clock::now();
+      go = true;
+      for (auto &thread : threads) {
+         thread.join();
+      }
+      const auto elapsedSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      return elapsedSec > 0 ? static_cast<double>(ops) / elapsedSec : 0;
+   }
+
+   json runBenchmark(const Options &options, const std::vector<BinaryData> &keys
+      , size_t nbShards, size_t threadsCount, const std::string &filename)
+   {
+      json result = {
+         { "shards", nbShards },
+         { "threads", threadsCount },
+         { "keys", keys.size() },
+         { "ops", options.ops },
+         { "value_bytes", options.valueSize },
+         { "in_memory", filename.empty() },
+      };
+
+      CacheFileParams params;
+      params.nbElemLimit = keys.size();   // all keys fit, eviction is not measured
+      params.nbShards = nbShards;
+      params.syncMode = CacheFileSync::NoSync;
+      auto cache = std::make_unique<CacheFile>(filename, params);
+
+      const auto value = std::make_shared<const BinaryData>(BinaryData::fromString(
+         std::string(options.valueSize, 'v')));
+      result["put_per_sec"] = runThreads(threadsCount, options.ops, [&](size_t, size_t i) {
+         cache->put(keys[i % keys.size()], value);
+      });
+
+      std::atomic<uint64_t> hits{ 0 };
+      result["get_per_sec"] = runThreads(threadsCount, options.ops, [&](size_t, size_t i) {
+         // Multiplicative hash of op index gives random order without per-thread state
+         const auto index = static_cast<size_t>((i * 0x9E3779B97F4A7C15ULL) >> 17) % keys.size();
+         if (cache->get(keys[index])) {
+            ++hits;
+         }
+      });
+      result["hit_ratio"] = options.ops ? static_cast<double>(hits) / options.ops : 0;
+
+      cache.reset();
+      if (!filename.empty()) {
+         std::remove(filename.c_str());
+         std::remove((filename + "-lock").c_str());
+      }
+      return result;
+   }
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+   Options options;
+   if (!parseOptions(argc, argv, options)) {
+      std::cerr << "Usage: " << argv[0] << " [--shards 1,16] [--threads 1,4,8] [--keys 100000]"
+         " [--ops 1000000] [--value-size 256] [--file /tmp/cache_bench]\n";
+      return 1;
+   }
+
+   const auto keys = makeKeys(options.keys);
+   json results = json::array();
+   unsigned run = 0;
+   for (const auto threads : options.threads) {
+      for (const auto shards : options.shards) {
+         const auto filename = options.file.empty() ? std::string{}
+            : options.file + "." + std::to_string(run++);
+         results.push_back(runBenchmark(options, keys, shards, threads, filename));
+         std::cerr << results.back().dump() << "\n";
+      }
+   }
+
+   std::cout << results.dump(2) << std::endl;
+   return 0;
+}
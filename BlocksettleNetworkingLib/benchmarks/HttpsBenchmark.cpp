@@ -0,0 +1,479 @@
+/*
+
+***********************************************************************************
+* Copyright (C) 2021, BlockSettle AB
+* Distributed under the GNU Affero General Public License (AGPL v3)
+* See LICENSE or http://www.gnu.org/licenses/agpl.html
+*
+**********************************************************************************
+
+*/
+
+// Loopback HTTPS benchmark (built with -DBUILD_BENCHMARKS=ON).
+// Starts TLS HTTP/1.1 keep-alive echo server with self-signed certificate on 127.0.0.1
+// and HttpsConnection clients, every client keeps --inflight requests in flight (closed loop).
+// Reports requests per second, round-trip latency percentiles and connection reuse counters
+// as JSON array on stdout.
+//
+// Usage: https_benchmark [--sizes 64,1024,65536] [--clients 1,10,100] [--inflight 1,8]
+//    [--requests 1000] [--port 18600]
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <nlohmann/json.hpp>
+#include <openssl/evp.h>
+#include <openssl/ec.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <spdlog/spdlog.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+
+#include "HttpsConnection.h"
+
+using json = nlohmann::json;
+
+// Sent in User-Agent by HttpsConnection, defined by the application
+const char* version = "benchmark";
+
+namespace {
+
+   const auto kRunTimeout = std::chrono::minutes(5);
+   const int kAcceptPollMs = 100;
+
+   struct Options
+   {
+      std::vector<size_t> sizes{ 64, 1024, 64 * 1024 };
+      std::vector<size_t> clients{ 1, 10, 100 };
+      std::vector<size_t> inflight{ 1, 8 };
+      size_t requests{ 1000 };
+      int port{ 18600 };
+   };
+
+   std::vector<size_t> splitNumbers(const std::string &value)
+   {
+      std::vector<size_t> result;
+      std::stringstream ss(value);
+      std::string item;
+      while (std::getline(ss, item, ',')) {
+         if (!item.empty()) {
+            result.push_back(std::stoul(item));
+         }
+      }
+      return result;
+   }
+
+   bool parseOptions(int argc, char **argv, Options &options)
+   {
+      for (int i = 1; i < argc; ++i) {
+         const std::string arg = argv[i];
+         if (i + 1 >= argc) {
+            return false;
+         }
+         const std::string value = argv[++i];
+         if (arg == "--sizes") {
+            options.sizes = splitNumbers(value);
+         } else if (arg == "--clients") {
+            options.clients = splitNumbers(value);
+         } else if (arg == "--inflight") {
+            options.inflight = splitNumbers(value);
+         } else if (arg == "--requests") {
+            options.requests = std::stoul(value);
+         } else if (arg == "--port") {
+            options.port = std::stoi(value);
+         } else {
+            return false;
+         }
+      }
+      return true;
+   }
+
+   size_t contentLength(std::string headers)
+   {
+      std::transform(headers.begin(), headers.end(), headers.begin(), [](unsigned char c) {
+         return static_cast<char>(std::tolower(c));
+      });
+      const auto pos = headers.find("\r\ncontent-length:");
+      if (pos == std::string::npos) {
+         return 0;
+      }
+      return std::stoul(headers.substr(pos + 17));
+   }
+
+   // Echoes request body back in the response. Each accepted connection is served by own
+   // blocking thread, server side cost is not what is measured here.
+   class TlsEchoServer
+   {
+   public:
+      ~TlsEchoServer()
+      {
+         stop();
+         if (ctx_) {
+            SSL_CTX_free(ctx_);
+         }
+      }
+
+      bool start(int port)
+      {
+         if (!createContext()) {
+            return false;
+         }
+         listenSock_ = socket(AF_INET, SOCK_STREAM, 0);
+         if (listenSock_ < 0) {
+            return false;
+         }
+         const int reuse = 1;
+         setsockopt(listenSock_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+         struct sockaddr_in sa;
+         memset(&sa, 0, sizeof(sa));
+         sa.sin_family = AF_INET;
+         sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+         sa.sin_port = htons(static_cast<uint16_t>(port));
+         if (bind(listenSock_, (struct sockaddr*)&sa, sizeof(sa)) || listen(listenSock_, SOMAXCONN)) {
+            return false;
+         }
+         acceptThread_ = std::thread([this] {
+            acceptLoop();
+         });
+         return true;
+      }
+
+      void stop()
+      {
+         if (stopped_.exchange(true)) {
+            return;
+         }
+         if (acceptThread_.joinable()) {
+            acceptThread_.join();
+         }
+         if (listenSock_ >= 0) {
+            close(listenSock_);
+         }
+         std::vector<std::thread> threads;
+         {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const auto sock : sockets_) {
+               shutdown(sock, SHUT_RDWR);
+            }
+            threads.swap(threads_);
+         }
+         for (auto &thread : threads) {
+            thread.join();
+         }
+      }
+
+   private:
+      bool createContext()
+      {
+         ctx_ = SSL_CTX_new(TLS_server_method());
+         if (!ctx_) {
+            return false;
+         }
+         EVP_PKEY *pkey = nullptr;
+         auto pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+         if (!pctx || (EVP_PKEY_keygen_init(pctx) <= 0)
+            || (EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, NID_X9_62_prime256v1) <= 0)
+            || (EVP_PKEY_keygen(pctx, &pkey) <= 0)) {
+            EVP_PKEY_CTX_free(pctx);
+            return false;
+         }
+         EVP_PKEY_CTX_free(pctx);
+
+         auto cert = X509_new();
+         X509_set_version(cert, 2);
+         ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+         X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+         X509_gmtime_adj(X509_getm_notAfter(cert), 24 * 3600);
+         X509_set_pubkey(cert, pkey);
+         auto name = X509_get_subject_name(cert);
+         X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC
+            , reinterpret_cast<const unsigned char *>("localhost"), -1, -1, 0);
+         X509_set_issuer_name(cert, name);
+         const bool result = X509_sign(cert, pkey, EVP_sha256())
+            && (SSL_CTX_use_certificate(ctx_, cert) == 1)
+            && (SSL_CTX_use_PrivateKey(ctx_, pkey) == 1);
+         X509_free(cert);
+         EVP_PKEY_free(pkey);
+         return result;
+      }
+
+      void acceptLoop()
+      {
+         while (!stopped_) {
+            pollfd fd;
+            fd.fd = listenSock_;
+            fd.events = POLLIN;
+            fd.revents = 0;
+            if (poll(&fd, 1, kAcceptPollMs) <= 0) {
+               continue;
+            }
+            const int sock = accept(listenSock_, nullptr, nullptr);
+            if (sock < 0) {
+               continue;
+            }
+            const int noDelay = 1;
+            setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+            std::lock_guard<std::mutex> lock(mutex_);
+            sockets_.push_back(sock);
+            threads_.emplace_back([this, sock] {
+               serve(sock);
+            });
+         }
+      }
+
+      void serve(int sock)
+      {
+         auto ssl = SSL_new(ctx_);
+         SSL_set_fd(ssl, sock);
+         if (SSL_accept(ssl) == 1) {
+            std::string buffer;
+            char buf[16 * 1024];
+            bool ok = true;
+            while (ok && !stopped_) {
+               // Pipelined requests are answered in one write
+               std::string responses;
+               while (true) {
+                  const auto headersEnd = buffer.find("\r\n\r\n");
+                  if (headersEnd == std::string::npos) {
+                     break;
+                  }
+                  const auto bodyLen = contentLength(buffer.substr(0, headersEnd + 2));
+                  if (buffer.size() < headersEnd + 4 + bodyLen) {
+                     break;
+                  }
+                  responses += "HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(bodyLen)
+                     + "\r\nConnection: keep-alive\r\n\r\n";
+                  responses.append(buffer, headersEnd + 4, bodyLen);
+                  buffer.erase(0, headersEnd + 4 + bodyLen);
+               }
+               if (!responses.empty()
+                  && (SSL_write(ssl, responses.data(), static_cast<int>(responses.size())) <= 0)) {
+                  break;
+               }
+               const int len = SSL_read(ssl, buf, sizeof(buf));
+               if (len <= 0) {
+                  ok = false;
+               } else {
+                  buffer.append(buf, len);
+               }
+            }
+         }
+         SSL_free(ssl);
+         {
+            std::lock_guard<std::mutex> lock(mutex_);
+            sockets_.erase(std::remove(sockets_.begin(), sockets_.end(), sock), sockets_.end());
+         }
+         close(sock);
+      }
+
+      SSL_CTX  *ctx_{ nullptr };
+      int      listenSock_{ -1 };
+      std::atomic_bool  stopped_{ false };
+      std::thread       acceptThread_;
+      std::mutex        mutex_;
+      std::vector<int>  sockets_;
+      std::vector<std::thread>   threads_;
+   };
+
+   class BenchClient
+   {
+   public:
+      BenchClient(const std::shared_ptr<spdlog::logger> &logger, int port
+         , const std::string &payload, size_t count)
+         : payload_(payload), count_(count)
+         , headers_{ "Content-Type: application/octet-stream"
+            , "Content-Length: " + std::to_string(payload.size()) }
+         , conn_(std::make_unique<HttpsConnection>(logger, "127.0.0.1", static_cast<uint16_t>(port)))
+      {}
+
+      std::function<void()> onStateChanged;
+
+      void start(size_t inflight)
+      {
+         for (size_t i = 0; i < inflight; ++i) {
+            sendNext();
+         }
+      }
+
+      bool done() const { return failed_ || (completed_ >= count_); }
+      bool failed() const { return failed_; }
+      HttpsConnectionStats stats() const { return conn_->stats(); }
+
+      std::vector<uint64_t> latencies()
+      {
+         std::lock_guard<std::mutex> lock(mutex_);
+         return latenciesUs_;
+      }
+
+   private:
+      void sendNext()
+      {
+         if (issued_++ >= count_) {
+            return;
+         }
+         const auto sentAt = std::chrono::steady_clock::now();
+         conn_->sendPostRequest("/echo", payload_, headers_, [this, sentAt](int status, const std::string &body) {
+            const auto rtt = std::chrono::steady_clock::now() - sentAt;
+            if ((status != 200) || (body.size() != payload_.size())) {
+               failed_ = true;
+               onStateChanged();
+               return;
+            }
+            {
+               std::lock_guard<std::mutex> lock(mutex_);
+               latenciesUs_.push_back(static_cast<uint64_t>(
+                  std::chrono::duration_cast<std::chrono::microseconds>(rtt).count()));
+            }
+            if (++completed_ >= count_) {
+               onStateChanged();
+               return;
+            }
+            sendNext();
+         });
+      }
+
+      const std::string payload_;
+      const size_t count_;
+      const std::vector<std::string> headers_;
+      std::atomic<size_t> issued_{ 0 };
+      std::atomic<size_t> completed_{ 0 };
+      std::atomic_bool failed_{ false };
+      std::mutex mutex_;
+      std::vector<uint64_t> latenciesUs_;
+      // Destroyed first, so callbacks don't outlive the fields above
+      std::unique_ptr<HttpsConnection> conn_;
+   };
+
+   uint64_t percentile(const std::vector<uint64_t> &sorted, double p)
+   {
+      if (sorted.empty()) {
+         return 0;
+      }
+      const auto index = static_cast<size_t>(p * static_cast<double>(sorted.size() - 1));
+      return sorted[index];
+   }
+
+   json runBenchmark(const std::shared_ptr<spdlog::logger> &logger, size_t payloadSize
+      , size_t clientsCount, size_t inflight, size_t requests, int port)
+   {
+      json result = {
+         { "payload_bytes", payloadSize },
+         { "clients", clientsCount },
+         { "inflight", inflight },
+      };
+
+      TlsEchoServer server;
+      if (!server.start(port)) {
+         result["error"] = "server start failed";
+         return result;
+      }
+
+      std::mutex mutex;
+      std::condition_variable cv;
+      const auto notify = [&mutex, &cv] {
+         std::lock_guard<std::mutex> lock(mutex);
+         cv.notify_all();
+      };
+
+      const std::string payload(payloadSize, 'x');
+      std::vector<std::unique_ptr<BenchClient>> clients;
+      for (size_t i = 0; i < clientsCount; ++i) {
+         auto client = std::make_unique<BenchClient>(logger, port, payload, requests);
+         client->onStateChanged = notify;
+         clients.push_back(std::move(client));
+      }
+
+      // Connection setup is measured too, as the pool opens connections on demand
+      const auto start = std::chrono::steady_clock::now();
+      for (auto &client : clients) {
+         client->start(inflight);
+      }
+      {
+         std::unique_lock<std::mutex> lock(mutex);
+         cv.wait_for(lock, kRunTimeout, [&clients] {
+            return std::all_of(clients.begin(), clients.end(), [](const std::unique_ptr<BenchClient> &client) {
+               return client->done();
+            });
+         });
+      }
+      const auto elapsed = std::chrono::steady_clock::now() - start;
+
+      std::vector<uint64_t> latencies;
+      HttpsConnectionStats stats;
+      bool failed = false;
+      for (const auto &client : clients) {
+         const auto clientLatencies = client->latencies();
+         latencies.insert(latencies.end(), clientLatencies.begin(), clientLatencies.end());
+         const auto clientStats = client->stats();
+         stats.connectsCount += clientStats.connectsCount;
+         stats.resumedCount += clientStats.resumedCount;
+         stats.reusedCount += clientStats.reusedCount;
+         failed |= client->failed();
+      }
+      clients.clear();
+      server.stop();
+      std::sort(latencies.begin(), latencies.end());
+
+      const auto elapsedSec = std::chrono::duration<double>(elapsed).count();
+      result["requests"] = latencies.size();
+      result["elapsed_sec"] = elapsedSec;
+      result["req_per_sec"] = elapsedSec > 0 ? static_cast<double>(latencies.size()) / elapsedSec : 0;
+      result["p50_us"] = percentile(latencies, 0.5);
+      result["p99_us"] = percentile(latencies, 0.99);
+      result["p999_us"] = percentile(latencies, 0.999);
+      result["connects"] = stats.connectsCount;
+      result["resumed"] = stats.resumedCount;
+      result["reused"] = stats.reusedCount;
+      if (failed || (latencies.size() != requests * clientsCount)) {
+         result["error"] = "not all requests were answered";
+      }
+      return result;
+   }
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+   Options options;
+   if (!parseOptions(argc, argv, options)) {
+      std::cerr << "Usage: " << argv[0] << " [--sizes 64,1024] [--clients 1,10]"
+         " [--inflight 1,8] [--requests 1000] [--port 18600]\n";
+      return 1;
+   }
+
+   auto logger = spdlog::stderr_color_mt("bench");
+   logger->set_level(spdlog::level::warn);
+
+   json results = json::array();
+   int port = options.port;
+   for (const auto clients : options.clients) {
+      for (const auto inflight : options.inflight) {
+         for (const auto size : options.sizes) {
+            // New port for each run, so previous sockets in TIME_WAIT don't matter
+            results.push_back(runBenchmark(logger, size, clients, inflight, options.requests, port++));
+            std::cerr << results.back().dump() << "\n";
+         }
+      }
+   }
+
+   std::cout << results.dump(2) << std::endl;
+   return 0;
+}
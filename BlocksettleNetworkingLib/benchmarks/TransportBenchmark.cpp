@@ -0,0 +1,575 @@
+/*
+
+***********************************************************************************
+* Copyright (C) 2021, BlockSettle AB
+* Distributed under the GNU Affero General Public License (AGPL v3)
+* See LICENSE or http://www.gnu.org/licenses/agpl.html
+*
+**********************************************************************************
+
+*/
+
+// Loopback transport benchmark (built with -DBUILD_BENCHMARKS=ON).
+// Starts echo server and clients of each transport on 127.0.0.1, every client keeps
+// one message in flight (closed loop). Reports messages per second and round-trip
+// latency percentiles as JSON array on stdout.
+// ZMQ_STREAM carries no message boundaries, so the zmq server echoes raw data and the
+// client frames the echo by counting received bytes (payload size is fixed per run).
+//
+// Usage: transport_benchmark [--transports ws,ws_bip15x,zmq] [--sizes 64,1024,65536,1048576]
+//    [--clients 1,10,100,1000] [--messages 1000] [--port 18500]
+//
+// Reconnect storm mode: transport_benchmark --handshake-threads 0,4 [--storm-clients 1000]
+// All BIP15x clients connect at once (as after server restart), for each handshake executor
+// size (0 - handshakes are done in place). Reports connect time and handshake stats.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+
+#include "ActiveStreamClient.h"
+#include "Bip15xDataConnection.h"
+#include "Bip15xServerConnection.h"
+#include "FutureValue.h"
+#include "TransportBIP15x.h"
+#include "TransportBIP15xServer.h"
+#include "WsDataConnection.h"
+#include "WsServerConnection.h"
+#include "ZmqContext.h"
+#include "ZmqDataConnection.h"
+#include "ZmqStreamServerConnection.h"
+
+using json = nlohmann::json;
+
+namespace {
+
+   const auto kConnectTimeout = std::chrono::seconds(30);
+   const auto kRunTimeout = std::chrono::minutes(5);
+   // Messages per client are reduced for large payloads, so each run sends about that much
+   const size_t kMaxBytesPerClient = 256 * 1024 * 1024;
+
+   struct Options
+   {
+      std::vector<std::string> transports{ "ws", "ws_bip15x", "zmq" };
+      std::vector<size_t> sizes{ 64, 1024, 64 * 1024, 1024 * 1024 };
+      std::vector<size_t> clients{ 1, 10, 100, 1000 };
+      size_t messages{ 1000 };
+      int port{ 18500 };
+      // Reconnect storm mode if not empty
+      std::vector<size_t> handshakeThreads;
+      size_t stormClients{ 1000 };
+   };
+
+   std::vector<std::string> splitList(const std::string &value)
+   {
+      std::vector<std::string> result;
+      std::stringstream ss(value);
+      std::string item;
+      while (std::getline(ss, item, ',')) {
+         if (!item.empty()) {
+            result.push_back(item);
+         }
+      }
+      return result;
+   }
+
+   std::vector<size_t> splitNumbers(const std::string &value)
+   {
+      std::vector<size_t> result;
+      for (const auto &item : splitList(value)) {
+         result.push_back(std::stoul(item));
+      }
+      return result;
+   }
+
+   bool parseOptions(int argc, char **argv, Options &options)
+   {
+      for (int i = 1; i < argc; ++i) {
+         const std::string arg = argv[i];
+         if (i + 1 >= argc) {
+            return false;
+         }
+         const std::string value = argv[++i];
+         if (arg == "--transports") {
+            options.transports = splitList(value);
+         } else if (arg == "--sizes") {
+            options.sizes = splitNumbers(value);
+         } else if (arg == "--clients") {
+            options.clients = splitNumbers(value);
+         } else if (arg == "--messages") {
+            options.messages = std::stoul(value);
+         } else if (arg == "--port") {
+            options.port = std::stoi(value);
+         } else if (arg == "--handshake-threads") {
+            options.handshakeThreads = splitNumbers(value);
+         } else if (arg == "--storm-clients") {
+            options.stormClients = std::stoul(value);
+         } else {
+            return false;
+         }
+      }
+      return true;
+   }
+
+   class EchoServerListener : public ServerConnectionListener
+   {
+   public:
+      ServerConnection *server_{};
+
+      void OnDataFromClient(const std::string &clientId, const std::string &data) override
+      {
+         server_->SendDataToClient(clientId, data);
+      }
+      void OnClientConnected(const std::string &, const Details &) override {}
+      void OnClientDisconnected(const std::string &) override {}
+   };
+
+   // Server side of ZMQ stream client, data is passed as is in both directions
+   class RawStreamClient : public ActiveStreamClient
+   {
+   public:
+      RawStreamClient(const std::shared_ptr<spdlog::logger> &logger)
+         : ActiveStreamClient(logger)
+      {}
+
+      bool send(const std::string &data) override
+      {
+         return sendRawData(data);
+      }
+
+      bool frameData(const std::string &data, std::string &rawData) const override
+      {
+         rawData = data;
+         return true;
+      }
+
+      void onRawDataReceived(const std::string &rawData) override
+      {
+         notifyOnData(rawData);
+      }
+   };
+
+   class RawStreamServerConnection : public ZmqStreamServerConnection
+   {
+   public:
+      RawStreamServerConnection(const std::shared_ptr<spdlog::logger> &logger
+         , const std::shared_ptr<ZmqContext> &context)
+         : ZmqStreamServerConnection(logger, context)
+      {}
+
+   protected:
+      server_connection_ptr CreateActiveConnection() override
+      {
+         return std::make_shared<RawStreamClient>(logger_);
+      }
+   };
+
+   // Delivers received stream data in messages of the given size
+   class CountingZmqConnection : public ZmqDataConnection
+   {
+   public:
+      CountingZmqConnection(const std::shared_ptr<spdlog::logger> &logger, size_t messageSize)
+         : ZmqDataConnection(logger), messageSize_(std::max<size_t>(messageSize, 1))
+      {}
+
+      bool send(const std::string &data) override
+      {
+         return sendRawData(data);
+      }
+
+   protected:
+      void onRawDataReceived(const std::string &rawData) override
+      {
+         pendingData_.append(rawData);
+         while (pendingData_.size() >= messageSize_) {
+            notifyOnData(pendingData_.substr(0, messageSize_));
+            pendingData_.erase(0, messageSize_);
+         }
+      }
+
+   private:
+      const size_t messageSize_;
+      std::string pendingData_;
+   };
+
+   // Closed loop client: next message is sent when the echo of the previous one arrives
+   class BenchClient : public DataConnectionListener
+   {
+   public:
+      BenchClient(std::unique_ptr<DataConnection> conn, const std::string &payload, size_t count)
+         : conn_(std::move(conn)), payload_(payload), count_(count)
+      {
+         latenciesUs_.reserve(count);
+      }
+
+      bool open(const std::string &port)
+      {
+         return conn_->openConnection("127.0.0.1", port, this);
+      }
+
+      void start()
+      {
+         sendNext();
+      }
+
+      void close()
+      {
+         conn_->closeConnection();
+      }
+
+      bool connected() const { return connected_; }
+      bool failed() const { return failed_; }
+      bool done() const { return done_; }
+      const std::vector<uint64_t> &latencies() const { return latenciesUs_; }
+
+      std::function<void()> onStateChanged;
+
+      void OnDataReceived(const std::string &data) override
+      {
+         const auto rtt = std::chrono::steady_clock::now() - sentAt_;
+         if (data.size() != payload_.size()) {
+            failed_ = true;
+            onStateChanged();
+            return;
+         }
+         latenciesUs_.push_back(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(rtt).count()));
+         if (latenciesUs_.size() >= count_) {
+            done_ = true;
+            onStateChanged();
+            return;
+         }
+         sendNext();
+      }
+
+      void OnConnected() override
+      {
+         connected_ = true;
+         onStateChanged();
+      }
+
+      void OnDisconnected() override
+      {
+         if (!done_) {
+            failed_ = true;
+            onStateChanged();
+         }
+      }
+
+      void OnError(DataConnectionError) override
+      {
+         failed_ = true;
+         onStateChanged();
+      }
+
+   private:
+      void sendNext()
+      {
+         sentAt_ = std::chrono::steady_clock::now();
+         if (!conn_->send(payload_)) {
+            failed_ = true;
+            onStateChanged();
+         }
+      }
+
+      std::unique_ptr<DataConnection> conn_;
+      const std::string payload_;
+      const size_t count_;
+      std::chrono::steady_clock::time_point sentAt_;
+      std::vector<uint64_t> latenciesUs_;
+      std::atomic_bool connected_{ false };
+      std::atomic_bool failed_{ false };
+      std::atomic_bool done_{ false };
+   };
+
+   std::shared_ptr<bs::network::TransportBIP15xServer> makeBip15xServer(const std::shared_ptr<spdlog::logger> &logger)
+   {
+      const auto &cbTrustedClients = [] {
+         return bs::network::BIP15xPeers{};
+      };
+      return std::make_shared<bs::network::TransportBIP15xServer>(logger, cbTrustedClients
+         , bs::network::BIP15xAuthMode::OneWay);
+   }
+
+   std::unique_ptr<ServerConnection> makeServer(const std::shared_ptr<spdlog::logger> &logger
+      , const std::string &transport, const std::shared_ptr<ZmqContext> &zmqContext)
+   {
+      if (transport == "zmq") {
+         return std::make_unique<RawStreamServerConnection>(logger, zmqContext);
+      }
+      WsServerConnectionParams wsParams;
+      wsParams.maximumPacketSize = std::max<size_t>(wsParams.maximumPacketSize, 2 * 1024 * 1024);
+      auto wsServer = std::make_unique<WsServerConnection>(logger, wsParams);
+      if (transport == "ws") {
+         return std::move(wsServer);
+      }
+      return std::make_unique<Bip15xServerConnection>(logger, std::move(wsServer), makeBip15xServer(logger));
+   }
+
+   std::unique_ptr<DataConnection> makeClient(const std::shared_ptr<spdlog::logger> &logger
+      , const std::string &transport, const std::shared_ptr<ZmqContext> &zmqContext, size_t payloadSize)
+   {
+      if (transport == "zmq") {
+         auto zmqConn = std::make_unique<CountingZmqConnection>(logger, payloadSize);
+         zmqConn->SetContext(zmqContext);
+         return std::move(zmqConn);
+      }
+      WsDataConnectionParams wsParams;
+      wsParams.maximumPacketSize = std::max<size_t>(wsParams.maximumPacketSize, 2 * 1024 * 1024);
+      auto wsConn = std::make_unique<WsDataConnection>(logger, wsParams);
+      if (transport == "ws") {
+         return std::move(wsConn);
+      }
+      bs::network::BIP15xParams params;
+      params.ephemeralPeers = true;
+      params.authMode = bs::network::BIP15xAuthMode::OneWay;
+      auto bip15x = std::make_shared<bs::network::TransportBIP15xClient>(logger, params);
+      // Server key is ephemeral, accept it
+      bip15x->setKeyCb([](const std::string &, const std::string &, const std::string &
+         , const std::shared_ptr<FutureValue<bool>> &prompt) {
+         prompt->setValue(true);
+      });
+      return std::make_unique<Bip15xDataConnection>(logger, std::move(wsConn), bip15x);
+   }
+
+   uint64_t percentile(const std::vector<uint64_t> &sorted, double p)
+   {
+      if (sorted.empty()) {
+         return 0;
+      }
+      const auto index = static_cast<size_t>(p * static_cast<double>(sorted.size() - 1));
+      return sorted[index];
+   }
+
+   json runBenchmark(const std::shared_ptr<spdlog::logger> &logger, const std::string &transport
+      , size_t payloadSize, size_t clientsCount, size_t messages, int port)
+   {
+      json result = {
+         { "transport", transport },
+         { "payload_bytes", payloadSize },
+         { "clients", clientsCount },
+      };
+      const auto portStr = std::to_string(port);
+      const auto count = std::max<size_t>(1, std::min(messages, kMaxBytesPerClient / std::max<size_t>(payloadSize, 1)));
+
+      EchoServerListener serverListener;
+      const auto zmqContext = std::make_shared<ZmqContext>(logger);
+      auto server = makeServer(logger, transport, zmqContext);
+      serverListener.server_ = server.get();
+      if (!server->BindConnection("127.0.0.1", portStr, &serverListener)) {
+         result["error"] = "bind failed";
+         return result;
+      }
+
+      std::mutex mutex;
+      std::condition_variable cv;
+      const auto notify = [&mutex, &cv] {
+         std::lock_guard<std::mutex> lock(mutex);
+         cv.notify_all();
+      };
+
+      const std::string payload(payloadSize, 'x');
+      std::vector<std::unique_ptr<BenchClient>> clients;
+      for (size_t i = 0; i < clientsCount; ++i) {
+         auto client = std::make_unique<BenchClient>(makeClient(logger, transport, zmqContext, payloadSize)
+            , payload, count);
+         client->onStateChanged = notify;
+         if (!client->open(portStr)) {
+            result["error"] = "open failed";
+            return result;
+         }
+         clients.push_back(std::move(client));
+      }
+
+      const auto allMatch = [&clients](bool (BenchClient::*check)() const) {
+         return std::all_of(clients.begin(), clients.end(), [check](const std::unique_ptr<BenchClient> &client) {
+            return ((*client).*check)() || client->failed();
+         });
+      };
+      const auto anyFailed = [&clients] {
+         return std::any_of(clients.begin(), clients.end(), [](const std::unique_ptr<BenchClient> &client) {
+            return client->failed();
+         });
+      };
+
+      {
+         std::unique_lock<std::mutex> lock(mutex);
+         cv.wait_for(lock, kConnectTimeout, [&] { return allMatch(&BenchClient::connected); });
+      }
+      if (anyFailed() || !allMatch(&BenchClient::connected)) {
+         result["error"] = "connect failed";
+         for (auto &client : clients) {
+            client->close();
+         }
+         return result;
+      }
+
+      const auto start = std::chrono::steady_clock::now();
+      for (auto &client : clients) {
+         client->start();
+      }
+      {
+         std::unique_lock<std::mutex> lock(mutex);
+         cv.wait_for(lock, kRunTimeout, [&] { return allMatch(&BenchClient::done); });
+      }
+      const auto elapsed = std::chrono::steady_clock::now() - start;
+
+      for (auto &client : clients) {
+         client->close();
+      }
+
+      std::vector<uint64_t> latencies;
+      for (const auto &client : clients) {
+         latencies.insert(latencies.end(), client->latencies().begin(), client->latencies().end());
+      }
+      std::sort(latencies.begin(), latencies.end());
+
+      const auto elapsedSec = std::chrono::duration<double>(elapsed).count();
+      result["messages"] = latencies.size();
+      result["elapsed_sec"] = elapsedSec;
+      result["msg_per_sec"] = elapsedSec > 0 ? static_cast<double>(latencies.size()) / elapsedSec : 0;
+      result["p50_us"] = percentile(latencies, 0.5);
+      result["p99_us"] = percentile(latencies, 0.99);
+      result["p999_us"] = percentile(latencies, 0.999);
+      if (anyFailed() || (latencies.size() != count * clientsCount)) {
+         result["error"] = "not all messages were echoed";
+      }
+      return result;
+   }
+
+   json runHandshakeStorm(const std::shared_ptr<spdlog::logger> &logger, unsigned handshakeThreads
+      , size_t clientsCount, int port)
+   {
+      json result = {
+         { "transport", "ws_bip15x" },
+         { "mode", "handshake_storm" },
+         { "handshake_threads", handshakeThreads },
+         { "clients", clientsCount },
+      };
+      const auto portStr = std::to_string(port);
+
+      auto bip15x = makeBip15xServer(logger);
+      if (handshakeThreads > 0) {
+         // Queue is not the limit here, all clients should be served
+         bs::network::BIP15xHandshakeParams params;
+         params.maxQueue = std::max(params.maxQueue, clientsCount);
+         bip15x->setHandshakeThreads(handshakeThreads, params);
+      }
+      EchoServerListener serverListener;
+      auto server = std::make_unique<Bip15xServerConnection>(logger
+         , std::make_unique<WsServerConnection>(logger, WsServerConnectionParams{}), bip15x);
+      serverListener.server_ = server.get();
+      if (!server->BindConnection("127.0.0.1", portStr, &serverListener)) {
+         result["error"] = "bind failed";
+         return result;
+      }
+
+      std::mutex mutex;
+      std::condition_variable cv;
+      const auto notify = [&mutex, &cv] {
+         std::lock_guard<std::mutex> lock(mutex);
+         cv.notify_all();
+      };
+
+      // Clients are created first, so their key generation is not measured
+      const std::string payload(1, 'x');
+      std::vector<std::unique_ptr<BenchClient>> clients;
+      for (size_t i = 0; i < clientsCount; ++i) {
+         auto client = std::make_unique<BenchClient>(makeClient(logger, "ws_bip15x", nullptr, payload.size())
+            , payload, 1);
+         client->onStateChanged = notify;
+         clients.push_back(std::move(client));
+      }
+
+      const auto start = std::chrono::steady_clock::now();
+      for (auto &client : clients) {
+         client->open(portStr);
+      }
+      const auto settled = [&clients] {
+         return std::all_of(clients.begin(), clients.end(), [](const std::unique_ptr<BenchClient> &client) {
+            return client->connected() || client->failed();
+         });
+      };
+      {
+         std::unique_lock<std::mutex> lock(mutex);
+         cv.wait_for(lock, kConnectTimeout, settled);
+      }
+      const auto elapsed = std::chrono::steady_clock::now() - start;
+      const auto connected = std::count_if(clients.begin(), clients.end(), [](const std::unique_ptr<BenchClient> &client) {
+         return client->connected();
+      });
+      const auto stats = bip15x->handshakeStats();
+
+      for (auto &client : clients) {
+         client->close();
+      }
+
+      const auto elapsedSec = std::chrono::duration<double>(elapsed).count();
+      result["connected"] = connected;
+      result["elapsed_sec"] = elapsedSec;
+      result["handshakes_per_sec"] = elapsedSec > 0 ? static_cast<double>(connected) / elapsedSec : 0;
+      result["completed"] = stats.completedCount;
+      result["rejected"] = stats.rejectedCount;
+      result["max_queue_depth"] = stats.maxQueueDepth;
+      result["avg_latency_us"] = stats.avgLatencyUs;
+      result["max_latency_us"] = stats.maxLatencyUs;
+      if (static_cast<size_t>(connected) != clientsCount) {
+         result["error"] = "not all clients connected";
+      }
+      return result;
+   }
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+   Options options;
+   if (!parseOptions(argc, argv, options)) {
+      std::cerr << "Usage: " << argv[0] << " [--transports ws,ws_bip15x,zmq] [--sizes 64,1024]"
+         " [--clients 1,10] [--messages 1000] [--port 18500]\n"
+         "       " << argv[0] << " --handshake-threads 0,4 [--storm-clients 1000] [--port 18500]\n";
+      return 1;
+   }
+
+   auto logger = spdlog::stderr_color_mt("bench");
+   logger->set_level(spdlog::level::warn);
+
+   json results = json::array();
+   int port = options.port;
+   if (!options.handshakeThreads.empty()) {
+      for (const auto threads : options.handshakeThreads) {
+         results.push_back(runHandshakeStorm(logger, static_cast<unsigned>(threads), options.stormClients, port++));
+         std::cerr << results.back().dump() << "\n";
+      }
+      std::cout << results.dump(2) << std::endl;
+      return 0;
+   }
+
+   for (const auto &transport : options.transports) {
+      if ((transport != "ws") && (transport != "ws_bip15x") && (transport != "zmq")) {
+         std::cerr << "unknown transport " << transport << "\n";
+         return 1;
+      }
+      for (const auto clients : options.clients) {
+         for (const auto size : options.sizes) {
+            // New port for each run, so previous sockets in TIME_WAIT don't matter
+            results.push_back(runBenchmark(logger, transport, size, clients, options.messages, port++));
+            std::cerr << results.back().dump() << "\n";
+         }
+      }
+   }
+
+   std::cout << results.dump(2) << std::endl;
+   return 0;
+}
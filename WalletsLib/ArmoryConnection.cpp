@@ -1009,16 +1009,23 @@ bool ArmoryConnection::getFeeSchedule(const FloatMapCb &cb)
       }
    };
 
-   const auto &cbWrap = [logger=logger_, cbProcess]
+   const auto &cbWrap = [logger=logger_, cbProcess, cb]
       (ReturnMessage<std::map<unsigned int, DBClientClasses::FeeEstimateStruct>> feeStructMap)
    {
+      // Only data retrieval is guarded, so user callback is never invoked twice
+      std::map<unsigned int, DBClientClasses::FeeEstimateStruct> feeStructs;
       try {
-         cbProcess(feeStructMap.get());
+         feeStructs = feeStructMap.get();
       }
       catch (const std::exception &e) {
          logger->error("[getFeeSchedule (cbProcess)] Return data error - {}"
             , e.what());
+         if (cb) {
+            cb({});
+         }
+         return;
       }
+      cbProcess(std::move(feeStructs));
    };
    bdv_->getFeeSchedule(FEE_STRAT_ECONOMICAL, cbWrap);
    return true;